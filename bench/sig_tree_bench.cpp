@@ -1,19 +1,36 @@
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <cmath>
 #include <iostream>
+#include <limits>
 #include <random>
 #include <set>
+#include <thread>
 #include <unordered_set>
 
+#include "../src/hugepage_allocator.h"
+#include "../src/sharded_sig_tree.h"
 #include "../src/sig_tree.h"
 #include "../src/sig_tree_impl.h"
+#include "../src/sig_tree_iterator_impl.h"
+#include "../src/sig_tree_lookup_impl.h"
 #include "../src/sig_tree_mop_impl.h"
 #include "../src/sig_tree_node_impl.h"
+#include "../src/sig_tree_range_impl.h"
 #include "../src/sig_tree_rebuild_impl.h"
 #include "../src/sig_tree_visit_impl.h"
 
 namespace sgt::sig_tree_bench {
     // 字符串比较次数
-    static unsigned int sig_tree_cmp_times = 0;
+    // 多线程压测时各线程各自计数, 只统计主线程
+    static thread_local unsigned int sig_tree_cmp_times = 0;
     static unsigned int std_set_cmp_times = 0;
 
     /*
@@ -64,17 +81,36 @@ namespace sgt::sig_tree_bench {
             return rep % 2 == 1;
         }
 
+        // 供 MultiSeek 在比较 Key 前预取 KV
+        static void Prefetch(const uint64_t & rep) {
+            __builtin_prefetch(reinterpret_cast<const char *>(rep));
+        }
+
         static void * Base() {
             return nullptr;
         }
     };
 
+    /*
+     * 同 KVTrans, 但隐藏其静态的 Base() (私有成员对 has_base 不可见)
+     * 树转而使用 Allocator::Base(), 供 offset 为相对地址的 Allocator (如 HugePageAllocator) 使用
+     */
+    class RelativeKVTrans : public KVTrans {
+    public:
+        explicit RelativeKVTrans(const char * s) : KVTrans(s) {}
+
+    private:
+        static void * Base();
+    };
+    static_assert(!has_base<RelativeKVTrans>::value);
+
     /*
      * Helper 接口定义了如何生成和使用 KV Token
      */
-    class Helper final : public SignatureTreeTpl<KVTrans>::Helper {
+    template<typename KV_TRANS>
+    class HelperTpl final : public SignatureTreeHelperTpl<KV_TRANS> {
     public:
-        ~Helper() override = default;
+        ~HelperTpl() override = default;
 
     public:
         // 根据要存储的 KV 返回一个 Token
@@ -85,7 +121,7 @@ namespace sgt::sig_tree_bench {
         }
 
         // 释放资源, 由于 KV 的所有权在外部, 这里不需要任何操作
-        void Del(KVTrans & trans) override {}
+        void Del(KV_TRANS & trans) override {}
 
         // Allocator.AllocatePage() 后获得的 offset 必须要能够打包进 Token
         // 言下之意就是 Token(默认类型 uint64_t) 的空间内必须能自省表达两种数据
@@ -108,23 +144,29 @@ namespace sgt::sig_tree_bench {
             return rep % 2 == 1;
         }
 
-        KVTrans Trans(const uint64_t & rep) const override {
+        KV_TRANS Trans(const uint64_t & rep) const override {
             // Token(rep) => KVTrans => KV
-            return KVTrans(reinterpret_cast<char *>(static_cast<uintptr_t>(rep)));
+            return KV_TRANS(reinterpret_cast<char *>(static_cast<uintptr_t>(rep)));
         }
     };
 
+    typedef HelperTpl<KVTrans> Helper;
+
     /*
      * 内存分配器
      *
-     * 如果分配在 file-backed mmap 上可作为硬盘索引
+     * 如果分配在 file-backed mmap 上可作为硬盘索引, 见 src/mmap_allocator.h
      * 直接 malloc 就是内存索引
      */
     class AllocatorImpl final : public Allocator {
     public:
         std::unordered_set<uintptr_t> records_;
+        const size_t page_size_;
 
     public:
+        // 页大小须与树的 NODE_POLICY 一致
+        explicit AllocatorImpl(size_t page_size = kPageSize) : page_size_(page_size) {}
+
         // 释放已分配的内存
         ~AllocatorImpl() override {
             for (uintptr_t record:records_) {
@@ -141,11 +183,11 @@ namespace sgt::sig_tree_bench {
             return nullptr;
         }
 
-        // 分配一页内存, 大小为 kPageSize
+        // 分配一页内存, 大小为 page_size_
         // 如果是 mmap 且需要扩容才能完成分配, 务必 throw AllocatorFullException
         // SGT 会捕获这一异常并调用 Grow(), 再根据 Base() 重新计算内存位置
         size_t AllocatePage() override {
-            auto page = reinterpret_cast<uintptr_t>(malloc(kPageSize));
+            auto page = reinterpret_cast<uintptr_t>(malloc(page_size_));
             records_.emplace(page);
             return page;
         }
@@ -161,6 +203,60 @@ namespace sgt::sig_tree_bench {
         void Grow() override {}
     };
 
+    /*
+     * 本线程用户态的 dTLB load miss 计数, 基于 perf_event_open
+     * 无 PMU (虚拟机) 或权限不足 (perf_event_paranoid) 时 Available() 为 false
+     */
+    class DtlbMissCounter {
+    private:
+        int fd_;
+
+    public:
+        DtlbMissCounter() {
+            perf_event_attr attr{};
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.size = sizeof(attr);
+            attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                          (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+
+        ~DtlbMissCounter() {
+            if (fd_ >= 0) {
+                close(fd_);
+            }
+        }
+
+        DtlbMissCounter(const DtlbMissCounter &) = delete;
+
+        DtlbMissCounter & operator=(const DtlbMissCounter &) = delete;
+
+    public:
+        bool Available() const { return fd_ >= 0; }
+
+        void Start() {
+            if (fd_ >= 0) {
+                ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+
+        uint64_t Stop() {
+            uint64_t count = 0;
+            if (fd_ >= 0) {
+                ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+                if (read(fd_, &count, sizeof(count)) != sizeof(count)) {
+                    count = 0;
+                }
+            }
+            return count;
+        }
+    };
+
 #define TIME_START auto start = std::chrono::high_resolution_clock::now()
 #define TIME_END auto end = std::chrono::high_resolution_clock::now()
 #define PRINT_TIME(name) \
@@ -235,6 +331,38 @@ std::cout << name " took " << std::chrono::duration_cast<std::chrono::millisecon
             TIME_END;
             PRINT_TIME("std::unordered_set - emplace");
         }
+        {
+            Helper helper_multi_add;
+            AllocatorImpl allocator_multi_add;
+            SignatureTreeTpl<KVTrans> tree_multi_add(&helper_multi_add, &allocator_multi_add);
+            constexpr size_t kBatchSize = 4096;
+            std::vector<Slice> ss;
+            std::vector<Slice> vs(kBatchSize);
+            TIME_START;
+            for (size_t i = 0; i < src.size(); i += kBatchSize) {
+                ss.clear();
+                for (size_t j = i; j < std::min(i + kBatchSize, src.size()); ++j) {
+                    ss.emplace_back(reinterpret_cast<char *>(src[j]));
+                }
+                tree_multi_add.MultiAdd(ss.data(), vs.data(), ss.size());
+            }
+            TIME_END;
+            PRINT_TIME("SGT - MultiAdd (4096 per batch)");
+
+            // 与末尾的 SGT - Del 对比
+            {
+                TIME_START;
+                for (size_t i = 0; i < src.size(); i += kBatchSize) {
+                    ss.clear();
+                    for (size_t j = i; j < std::min(i + kBatchSize, src.size()); ++j) {
+                        ss.emplace_back(reinterpret_cast<char *>(src[j]));
+                    }
+                    tree_multi_add.MultiDel(ss.data(), ss.size());
+                }
+                TIME_END;
+                PRINT_TIME("SGT - MultiDel (4096 per batch)");
+            }
+        }
         // Add - 结束
         // Get - 开始
         {
@@ -287,6 +415,32 @@ std::cout << name " took " << std::chrono::duration_cast<std::chrono::millisecon
             TIME_END;
             PRINT_TIME("SGT - MultiGetWithCallback<10>");
         }
+        {
+            // 批大小 x 流水线宽度
+            std::vector<Slice> ss;
+            ss.reserve(src.size());
+            for (const auto & s:src) {
+                ss.emplace_back(reinterpret_cast<char *>(s));
+            }
+            for (size_t batch:{1, 16, 256, 4096}) {
+                for (size_t width:{1, 8, 16, 32}) {
+                    if (width > batch) {
+                        break;
+                    }
+                    size_t found = 0;
+                    auto start = std::chrono::high_resolution_clock::now();
+                    for (size_t i = 0; i < ss.size(); i += batch) {
+                        tree.MultiGet(ss.data() + i, std::min(batch, ss.size() - i),
+                                      [&found](size_t, uint64_t * rep) { found += (rep != nullptr); }, width);
+                    }
+                    auto end = std::chrono::high_resolution_clock::now();
+                    assert(found == ss.size());
+                    std::cout << "SGT - MultiGet batch " << batch << " x width " << width << " took "
+                              << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()
+                              << " milliseconds" << std::endl;
+                }
+            }
+        }
         {
             TIME_START;
             for (const auto & s:src) {
@@ -295,6 +449,95 @@ std::cout << name " took " << std::chrono::duration_cast<std::chrono::millisecon
             TIME_END;
             PRINT_TIME("SGT - GetWithCallback");
         }
+        for (size_t width:{8, 16, 64, 256}) {
+            SignatureTreeTpl<KVTrans>::LookupScheduler scheduler(&tree, width);
+            size_t found = 0;
+            auto start = std::chrono::high_resolution_clock::now();
+            for (const auto & s:src) {
+                scheduler.Submit(reinterpret_cast<char *>(s), [&found](uint64_t * rep) { found += (rep != nullptr); });
+                if (scheduler.Inflight() >= width) {
+                    scheduler.Poll();
+                }
+            }
+            scheduler.Run();
+            auto end = std::chrono::high_resolution_clock::now();
+            assert(found == src.size());
+            std::cout << "SGT - LookupScheduler x width " << width << " took "
+                      << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()
+                      << " milliseconds" << std::endl;
+        }
+        {
+            // 多线程并发查找, 线程数从 1 倍增至硬件核数
+            // sig_tree_cmp_times 为 thread_local, 各线程各自计数, 互不竞争
+            size_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+            for (size_t n = 1; ; n = std::min(n * 2, max_threads)) {
+                TIME_START;
+                std::vector<std::thread> threads;
+                for (size_t t = 0; t < n; ++t) {
+                    threads.emplace_back([&tree, &src]() {
+                        for (const auto & s:src) {
+                            tree.Get(reinterpret_cast<char *>(s), nullptr);
+                        }
+                    });
+                }
+                for (auto & thread:threads) {
+                    thread.join();
+                }
+                TIME_END;
+                auto ms = std::max<long>(std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count(), 1);
+                std::cout << "SGT - Get x " << n << " threads took " << ms << " milliseconds, "
+                          << src.size() * n / ms << " ops/ms" << std::endl;
+                if (n == max_threads) {
+                    break;
+                }
+            }
+        }
+        {
+            // 分片 Add/Get, 线程数从 1 倍增至硬件核数, 分片数取 1 与线程数
+            // 每个线程写入 src 中互不相交的一段, 再查询同一段
+            size_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+            for (size_t n = 1; ; n = std::min(n * 2, max_threads)) {
+                for (size_t shard_num:{size_t(1), n}) {
+                    std::vector<AllocatorImpl> allocators(shard_num);
+                    std::vector<Allocator *> allocator_ptrs;
+                    for (auto & a:allocators) {
+                        allocator_ptrs.emplace_back(&a);
+                    }
+                    ShardedSignatureTreeTpl<KVTrans> sharded(&helper, allocator_ptrs);
+
+                    auto run = [&src, n](auto && op) {
+                        auto start = std::chrono::high_resolution_clock::now();
+                        std::vector<std::thread> threads;
+                        for (size_t t = 0; t < n; ++t) {
+                            threads.emplace_back([&src, &op, n, t]() {
+                                size_t from = src.size() * t / n;
+                                size_t to = src.size() * (t + 1) / n;
+                                for (size_t i = from; i < to; ++i) {
+                                    op(reinterpret_cast<char *>(src[i]));
+                                }
+                            });
+                        }
+                        for (auto & thread:threads) {
+                            thread.join();
+                        }
+                        auto end = std::chrono::high_resolution_clock::now();
+                        return std::max<long>(std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count(), 1);
+                    };
+
+                    auto add_ms = run([&sharded](const char * s) { sharded.Add(s, {}); });
+                    auto get_ms = run([&sharded](const char * s) { sharded.Get(s, nullptr); });
+                    std::cout << "SGT - Sharded x " << shard_num << " shards x " << n << " threads - Add took "
+                              << add_ms << " milliseconds, " << src.size() / add_ms << " ops/ms; Get took "
+                              << get_ms << " milliseconds, " << src.size() / get_ms << " ops/ms" << std::endl;
+                    if (shard_num == n) {
+                        break;
+                    }
+                }
+                if (n == max_threads) {
+                    break;
+                }
+            }
+        }
         {
             TIME_START;
             tree.Compact();
@@ -311,6 +554,20 @@ std::cout << name " took " << std::chrono::duration_cast<std::chrono::millisecon
                 TIME_END;
                 PRINT_TIME("SGT - Rebuild");
             }
+        }
+        {
+            Helper helper_rebuild;
+            AllocatorImpl allocator_rebuild;
+            SignatureTreeTpl<KVTrans> tree_rebuild(&helper_rebuild, &allocator_rebuild);
+            size_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+            {
+                TIME_START;
+                tree.Rebuild(&tree_rebuild, max_threads);
+                TIME_END;
+                std::cout << "SGT - Rebuild x " << max_threads << " threads took "
+                          << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()
+                          << " milliseconds" << std::endl;
+            }
             {
                 TIME_START;
                 tree_rebuild.VisitDel<tree.kBackward>({}, [](auto) {
@@ -321,12 +578,626 @@ std::cout << name " took " << std::chrono::duration_cast<std::chrono::millisecon
                 assert(tree_rebuild.Size() == 0);
             }
         }
+        {
+            // 删除首字节在 [0x40, 0x80) 的约 1/4 Key: VisitDel 逐个删除与 DeleteRange 对比
+            // 连同结尾的 \0 作为 Key, 与树中 C 式字符串逐字节比较时不越界
+            const Slice lo("\x40", 2);
+            const Slice hi("\x80", 2);
+            Helper helper_range;
+            AllocatorImpl allocator_visit_del;
+            AllocatorImpl allocator_delete_range;
+            SignatureTreeTpl<KVTrans> tree_visit_del(&helper_range, &allocator_visit_del);
+            SignatureTreeTpl<KVTrans> tree_delete_range(&helper_range, &allocator_delete_range);
+            tree.Rebuild(&tree_visit_del);
+            tree.Rebuild(&tree_delete_range);
+            size_t visit_deleted = 0;
+            {
+                TIME_START;
+                tree_visit_del.VisitDel<tree.kForward>(lo, [&](uint64_t & rep) {
+                    if (strcmp(helper_range.Trans(rep).Key().data(), hi.data()) >= 0) {
+                        return std::make_pair(false, false);
+                    }
+                    ++visit_deleted;
+                    return std::make_pair(true, true);
+                });
+                TIME_END;
+                PRINT_TIME("SGT - VisitDel [lo, hi)");
+            }
+            {
+                TIME_START;
+                size_t deleted = tree_delete_range.DeleteRange(lo, hi);
+                TIME_END;
+                PRINT_TIME("SGT - DeleteRange [lo, hi)");
+                assert(deleted == visit_deleted);
+                static_cast<void>(deleted);
+            }
+        }
+        {
+            // 有序输入: 逐个 Add 与 BulkLoad 对比
+            std::vector<uint8_t *> sorted(src);
+            std::sort(sorted.begin(), sorted.end(), [](const uint8_t * a, const uint8_t * b) {
+                return strcmp(reinterpret_cast<const char *>(a), reinterpret_cast<const char *>(b)) < 0;
+            });
+            sorted.erase(std::unique(sorted.begin(), sorted.end(), [](const uint8_t * a, const uint8_t * b) {
+                return strcmp(reinterpret_cast<const char *>(a), reinterpret_cast<const char *>(b)) == 0;
+            }), sorted.end());
+            {
+                AllocatorImpl allocator_sorted;
+                SignatureTreeTpl<KVTrans> tree_sorted(&helper, &allocator_sorted);
+                TIME_START;
+                for (const auto & s:sorted) {
+                    tree_sorted.Add(reinterpret_cast<char *>(s), {});
+                }
+                TIME_END;
+                PRINT_TIME("SGT - Add (sorted)");
+            }
+            {
+                AllocatorImpl allocator_bulk;
+                SignatureTreeTpl<KVTrans> tree_bulk(&helper, &allocator_bulk);
+                TIME_START;
+                auto it = sorted.cbegin();
+                tree_bulk.BulkLoad([&it, &sorted](Slice * k, uint64_t * rep) {
+                    if (it == sorted.cend()) {
+                        return false;
+                    }
+                    *k = reinterpret_cast<char *>(*it);
+                    *rep = reinterpret_cast<uintptr_t>(*it++);
+                    return true;
+                });
+                TIME_END;
+                PRINT_TIME("SGT - BulkLoad");
+                std::cout << "sig_tree_bulk_load_mem_pages: " << allocator_bulk.records_.size() << std::endl;
+            }
+        }
         {
             TIME_START;
             tree.Visit<tree.kForward>({}, [](auto) { return true; });
             TIME_END;
             PRINT_TIME("SGT - Visit");
         }
+        {
+            // 全表扫描并读取每个 Key: Visit 单线程, ParallelVisit 线程数从 1 倍增至硬件核数
+            // 各 part 的累加分散到不同缓存行, 避免线程间争用
+            struct alignas(64) Sum {
+                std::atomic<size_t> val{0};
+            };
+            auto key_len = [&helper](const uint64_t & rep) { return helper.Trans(rep).Key().size(); };
+            size_t visit_len = 0;
+            {
+                TIME_START;
+                tree.Visit<tree.kForward>({}, [&](const uint64_t & rep) {
+                    visit_len += key_len(rep);
+                    return true;
+                });
+                TIME_END;
+                PRINT_TIME("SGT - Visit + Key");
+            }
+            size_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+            for (size_t n = 1; ; n = std::min(n * 2, max_threads)) {
+                std::array<Sum, 64> sums;
+                TIME_START;
+                tree.ParallelVisit({}, {}, n, [&](size_t part, const uint64_t & rep) {
+                    sums[part % sums.size()].val.fetch_add(key_len(rep), std::memory_order_relaxed);
+                    return true;
+                });
+                TIME_END;
+                std::cout << "SGT - ParallelVisit + Key x " << n << " threads took "
+                          << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()
+                          << " milliseconds" << std::endl;
+                size_t len = 0;
+                for (const auto & sum:sums) {
+                    len += sum.val.load();
+                }
+                assert(len == visit_len);
+                static_cast<void>(len);
+                if (n == max_threads) {
+                    break;
+                }
+            }
+            {
+                size_t len = 0;
+                TIME_START;
+                tree.ParallelVisit<true>({}, {}, max_threads, [&](size_t, const uint64_t & rep) {
+                    len += key_len(rep);
+                    return true;
+                });
+                TIME_END;
+                std::cout << "SGT - ParallelVisit<ordered> + Key x " << max_threads << " threads took "
+                          << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()
+                          << " milliseconds" << std::endl;
+                assert(len == visit_len);
+            }
+        }
+        {
+            // 4096 个随机 2 字节前缀: Visit 自前缀开始逐个比较 Key, 与 VisitPrefix / CountPrefix 对比
+            // Seek 的 target 须带 '\0', 以 "P\0" 作为起点
+            std::vector<std::array<char, 3>> prefixes(4096);
+            for (auto & prefix:prefixes) {
+                prefix = {static_cast<char>(dist(engine)), static_cast<char>(dist(engine)), 0};
+            }
+            size_t visit_cnt = 0;
+            {
+                TIME_START;
+                for (const auto & prefix:prefixes) {
+                    tree.Visit<tree.kForward>(Slice(prefix.data(), 3), [&](const uint64_t & rep) {
+                        Slice k = helper.Trans(rep).Key();
+                        if (k.size() < 2 || memcmp(k.data(), prefix.data(), 2) != 0) {
+                            return false;
+                        }
+                        ++visit_cnt;
+                        return true;
+                    });
+                }
+                TIME_END;
+                PRINT_TIME("SGT - Visit as prefix scan");
+            }
+            size_t prefix_cnt = 0;
+            {
+                TIME_START;
+                for (const auto & prefix:prefixes) {
+                    tree.VisitPrefix(Slice(prefix.data(), 2), [&](const uint64_t &) {
+                        ++prefix_cnt;
+                        return true;
+                    });
+                }
+                TIME_END;
+                PRINT_TIME("SGT - VisitPrefix");
+            }
+            size_t count_cnt = 0;
+            {
+                TIME_START;
+                for (const auto & prefix:prefixes) {
+                    count_cnt += tree.CountPrefix(Slice(prefix.data(), 2));
+                }
+                TIME_END;
+                PRINT_TIME("SGT - CountPrefix");
+            }
+            assert(visit_cnt == prefix_cnt && prefix_cnt == count_cnt);
+            static_cast<void>(visit_cnt);
+            static_cast<void>(prefix_cnt);
+            static_cast<void>(count_cnt);
+        }
+        {
+            // 分页扫描, 每页 100 个: Visit 每页从上一页末尾重新 Seek, Iterator 保留路径
+            constexpr size_t kPageKeys = 100;
+            size_t visit_cnt = 0;
+            {
+                TIME_START;
+                std::string last;
+                while (true) {
+                    size_t cnt = 0;
+                    tree.Visit<tree.kForward>(last, [&](const uint64_t & rep) {
+                        Slice k = helper.Trans(rep).Key();
+                        if (!last.empty() && k == Slice(last)) {
+                            return true;
+                        }
+                        last.assign(k.data(), k.size());
+                        return ++cnt < kPageKeys;
+                    });
+                    visit_cnt += cnt;
+                    if (cnt < kPageKeys) {
+                        break;
+                    }
+                }
+                TIME_END;
+                PRINT_TIME("SGT - Visit paginated (100 per page)");
+            }
+            size_t iter_cnt = 0;
+            {
+                TIME_START;
+                SignatureTreeTpl<KVTrans>::Iterator iter(&tree);
+                iter.SeekToFirst();
+                while (iter.Valid()) {
+                    for (size_t cnt = 0; cnt < kPageKeys && iter.Valid(); ++cnt) {
+                        ++iter_cnt;
+                        iter.Next();
+                    }
+                }
+                TIME_END;
+                PRINT_TIME("SGT - Iterator paginated (100 per page)");
+            }
+            assert(visit_cnt == iter_cnt);
+            static_cast<void>(visit_cnt);
+            static_cast<void>(iter_cnt);
+        }
+        {
+            // 逐点查询 1M 个随机 Key: Visit 取首个满足条件的回调即停止, 与 LowerBound / Floor 对比
+            std::vector<std::array<uint8_t, 16>> probes(src.size());
+            for (auto & probe:probes) {
+                for (size_t i = 0; i < 15; ++i) {
+                    probe[i] = dist(engine);
+                }
+                probe[15] = 0;
+            }
+            auto key_at = [&probes](size_t i) { return Slice(reinterpret_cast<char *>(probes[i].data())); };
+
+            size_t visit_sum = 0;
+            {
+                TIME_START;
+                for (size_t i = 0; i < probes.size(); ++i) {
+                    tree.Visit<tree.kForward>(key_at(i), [&](const uint64_t & rep) {
+                        visit_sum += rep;
+                        return false;
+                    });
+                }
+                TIME_END;
+                PRINT_TIME("SGT - Visit as LowerBound");
+            }
+            size_t bound_sum = 0;
+            {
+                TIME_START;
+                for (size_t i = 0; i < probes.size(); ++i) {
+                    const uint64_t * rep = tree.LowerBound(key_at(i));
+                    bound_sum += rep != nullptr ? *rep : 0;
+                }
+                TIME_END;
+                PRINT_TIME("SGT - LowerBound");
+            }
+            assert(visit_sum == bound_sum);
+
+            visit_sum = 0;
+            {
+                TIME_START;
+                for (size_t i = 0; i < probes.size(); ++i) {
+                    // 反向 Visit 自首个不小于 target 的 rep 开始, 须跳过后继; 全部小于 target 时从末尾开始
+                    Slice k = key_at(i);
+                    bool visited = false;
+                    auto floor = [&](const uint64_t & rep) {
+                        visited = true;
+                        if (SliceComparator()(k, helper.Trans(rep).Key())) {
+                            return true;
+                        }
+                        visit_sum += rep;
+                        return false;
+                    };
+                    tree.Visit<tree.kBackward>(k, floor);
+                    if (!visited) {
+                        tree.Visit<tree.kBackward>({}, floor);
+                    }
+                }
+                TIME_END;
+                PRINT_TIME("SGT - Visit as Floor");
+            }
+            bound_sum = 0;
+            {
+                TIME_START;
+                for (size_t i = 0; i < probes.size(); ++i) {
+                    const uint64_t * rep = tree.Floor(key_at(i));
+                    bound_sum += rep != nullptr ? *rep : 0;
+                }
+                TIME_END;
+                PRINT_TIME("SGT - Floor");
+            }
+            assert(visit_sum == bound_sum);
+            static_cast<void>(visit_sum);
+            static_cast<void>(bound_sum);
+
+            // 短区间扫描: 每个 target 定位后读 8 个, 逐个 Seek 与 MultiSeek 对比
+            constexpr size_t kScanKeys = 8;
+            constexpr size_t kBatch = 256;
+            size_t seek_sum = 0;
+            {
+                TIME_START;
+                SignatureTreeTpl<KVTrans>::Iterator iter(&tree);
+                for (size_t i = 0; i < probes.size(); ++i) {
+                    iter.Seek(key_at(i));
+                    for (size_t cnt = 0; cnt < kScanKeys && iter.Valid(); ++cnt) {
+                        seek_sum += iter.Rep();
+                        iter.Next();
+                    }
+                }
+                TIME_END;
+                PRINT_TIME("SGT - Seek + 8 x Next");
+            }
+            size_t multi_seek_sum = 0;
+            {
+                TIME_START;
+                std::vector<Slice> targets(kBatch);
+                for (size_t i = 0; i < probes.size(); i += kBatch) {
+                    size_t n = std::min(kBatch, probes.size() - i);
+                    for (size_t j = 0; j < n; ++j) {
+                        targets[j] = key_at(i + j);
+                    }
+                    tree.MultiSeek(targets.data(), n, [&](size_t, SignatureTreeTpl<KVTrans>::Iterator & iter) {
+                        for (size_t cnt = 0; cnt < kScanKeys && iter.Valid(); ++cnt) {
+                            multi_seek_sum += iter.Rep();
+                            iter.Next();
+                        }
+                    });
+                }
+                TIME_END;
+                PRINT_TIME("SGT - MultiSeek batch 256 + 8 x Next");
+            }
+            assert(seek_sum == multi_seek_sum);
+            static_cast<void>(seek_sum);
+            static_cast<void>(multi_seek_sum);
+        }
+        {
+            // 区间大小估计与抽样: 均匀与偏斜 (前 3 字节取几何分布) 两组 Key
+            // 区间两端取自已有 Key, 跨度在 1 至 100k 个 Key 间按对数均匀分布, 与 Visit 逐个计数对比
+            // 误差为估计值与真实值之比 (取不小于 1 的一侧)
+            // 抽样按 rank 分为 100 个桶, 报告最大桶偏差与总变差距离, 与 Visit 一遍的蓄水池抽样对比
+            // 分位报告各段大小与 n / q 之比的范围
+            std::vector<uint8_t *> skewed(src.size());
+            std::geometric_distribution<int> geo(0.25);
+            for (auto & s:skewed) {
+                s = static_cast<uint8_t *>(malloc(16));
+                for (size_t i = 0; i < 15; ++i) {
+                    s[i] = i < 3 ? static_cast<uint8_t>(1 + std::min(geo(engine), 254)) : dist(engine);
+                }
+                s[15] = 0;
+            }
+
+            auto estimate = [&](const char * name, const std::vector<uint8_t *> & keys) {
+                AllocatorImpl allocator_est;
+                SignatureTreeTpl<KVTrans> tree_est(&helper, &allocator_est);
+                for (const auto & s:keys) {
+                    tree_est.Add(reinterpret_cast<char *>(s), {});
+                }
+                std::vector<uint8_t *> sorted(keys);
+                std::sort(sorted.begin(), sorted.end(), [](const uint8_t * a, const uint8_t * b) {
+                    return strcmp(reinterpret_cast<const char *>(a), reinterpret_cast<const char *>(b)) < 0;
+                });
+                sorted.erase(std::unique(sorted.begin(), sorted.end(), [](const uint8_t * a, const uint8_t * b) {
+                    return strcmp(reinterpret_cast<const char *>(a), reinterpret_cast<const char *>(b)) == 0;
+                }), sorted.end());
+                auto key_at = [&sorted](size_t i) {
+                    return i < sorted.size() ? Slice(reinterpret_cast<char *>(sorted[i]), 16) : Slice();
+                };
+
+                std::vector<std::pair<size_t, size_t>> ranges(4096);
+                std::uniform_real_distribution<double> exp10(0, 5);
+                for (auto & range:ranges) {
+                    range.first = engine() % sorted.size();
+                    range.second = std::min(sorted.size(),
+                                            range.first + static_cast<size_t>(std::pow(10, exp10(engine))));
+                }
+
+                std::vector<size_t> estimates(ranges.size());
+                auto est_start = std::chrono::high_resolution_clock::now();
+                for (size_t i = 0; i < ranges.size(); ++i) {
+                    estimates[i] = tree_est.EstimateRange(key_at(ranges[i].first), key_at(ranges[i].second));
+                }
+                auto est_end = std::chrono::high_resolution_clock::now();
+
+                size_t visit_cnt = 0;
+                auto visit_start = std::chrono::high_resolution_clock::now();
+                for (const auto & range:ranges) {
+                    Slice hi = key_at(range.second);
+                    tree_est.Visit<tree.kForward>(key_at(range.first), [&](const uint64_t & rep) {
+                        if (hi.size() != 0 && strcmp(helper.Trans(rep).Key().data(), hi.data()) >= 0) {
+                            return false;
+                        }
+                        ++visit_cnt;
+                        return true;
+                    });
+                }
+                auto visit_end = std::chrono::high_resolution_clock::now();
+
+                size_t expect_cnt = 0;
+                size_t within_2x = 0;
+                double ratio_sum = 0;
+                double ratio_max = 0;
+                for (size_t i = 0; i < ranges.size(); ++i) {
+                    auto expect = static_cast<double>(ranges[i].second - ranges[i].first);
+                    auto got = static_cast<double>(estimates[i]);
+                    double ratio = std::max(expect, got) / std::max(std::min(expect, got), 1.0);
+                    expect_cnt += ranges[i].second - ranges[i].first;
+                    within_2x += ratio <= 2;
+                    ratio_sum += ratio;
+                    ratio_max = std::max(ratio_max, ratio);
+                }
+                assert(visit_cnt == expect_cnt);
+                static_cast<void>(visit_cnt);
+                static_cast<void>(expect_cnt);
+
+                std::cout << "SGT - EstimateRange (" << name << ") x " << ranges.size() << " took "
+                          << std::chrono::duration_cast<std::chrono::microseconds>(est_end - est_start).count()
+                          << " microseconds, within 2x: " << within_2x * 100 / ranges.size()
+                          << "%, mean error: " << ratio_sum / ranges.size() << "x, max error: " << ratio_max
+                          << "x; Visit count took "
+                          << std::chrono::duration_cast<std::chrono::milliseconds>(visit_end - visit_start).count()
+                          << " milliseconds" << std::endl;
+
+                auto rank_of = [&](const uint64_t & rep) {
+                    const char * k = helper.Trans(rep).Key().data();
+                    return static_cast<size_t>(std::lower_bound(sorted.cbegin(), sorted.cend(), k,
+                                                                [](const uint8_t * a, const char * b) {
+                                                                    return strcmp(reinterpret_cast<const char *>(a),
+                                                                                  b) < 0;
+                                                                }) - sorted.cbegin());
+                };
+
+                constexpr size_t kSamples = 100000;
+                constexpr size_t kBuckets = 100;
+                auto sample_start = std::chrono::high_resolution_clock::now();
+                auto samples = tree_est.Sample(kSamples, engine);
+                auto sample_end = std::chrono::high_resolution_clock::now();
+                auto small_start = std::chrono::high_resolution_clock::now();
+                size_t small_size = tree_est.Sample(kSamples / 100, engine).size();
+                auto small_end = std::chrono::high_resolution_clock::now();
+                assert(samples.size() == kSamples && small_size == kSamples / 100);
+                static_cast<void>(small_size);
+                std::vector<size_t> buckets(kBuckets);
+                for (const auto & rep:samples) {
+                    size_t rank = rank_of(rep);
+                    assert(rank < sorted.size() && strcmp(reinterpret_cast<const char *>(sorted[rank]),
+                                                          helper.Trans(rep).Key().data()) == 0);
+                    ++buckets[rank * kBuckets / sorted.size()];
+                }
+                double bucket_dev = 0;
+                double tv = 0;
+                for (size_t i = 0; i < kBuckets; ++i) {
+                    // 桶的 rank 区间不等宽时按实际宽度计期望
+                    size_t width = ((i + 1) * sorted.size() + kBuckets - 1) / kBuckets -
+                                   (i * sorted.size() + kBuckets - 1) / kBuckets;
+                    double expect = static_cast<double>(width) / sorted.size();
+                    double got = static_cast<double>(buckets[i]) / samples.size();
+                    bucket_dev = std::max(bucket_dev, std::abs(got / expect - 1));
+                    tv += std::abs(got - expect) / 2;
+                }
+
+                std::vector<uint64_t> reservoir;
+                reservoir.reserve(kSamples);
+                size_t seen = 0;
+                auto reservoir_start = std::chrono::high_resolution_clock::now();
+                tree_est.Visit<tree.kForward>("", [&](const uint64_t & rep) {
+                    if (reservoir.size() < kSamples) {
+                        reservoir.emplace_back(rep);
+                    } else {
+                        size_t j = engine() % (seen + 1);
+                        if (j < kSamples) {
+                            reservoir[j] = rep;
+                        }
+                    }
+                    ++seen;
+                    return true;
+                });
+                auto reservoir_end = std::chrono::high_resolution_clock::now();
+
+                std::cout << "SGT - Sample (" << name << ") x " << kSamples << " took "
+                          << std::chrono::duration_cast<std::chrono::milliseconds>(sample_end - sample_start).count()
+                          << " milliseconds, max bucket deviation: " << bucket_dev * 100
+                          << "%, total variation: " << tv << "; x " << kSamples / 100 << " took "
+                          << std::chrono::duration_cast<std::chrono::microseconds>(small_end - small_start).count()
+                          << " microseconds; Visit reservoir took "
+                          << std::chrono::duration_cast<std::chrono::milliseconds>(
+                                  reservoir_end - reservoir_start).count()
+                          << " milliseconds" << std::endl;
+
+                constexpr size_t kQuantiles = 64;
+                auto quantile_start = std::chrono::high_resolution_clock::now();
+                auto splits = tree_est.Quantiles(kQuantiles);
+                auto quantile_end = std::chrono::high_resolution_clock::now();
+                double part_min = std::numeric_limits<double>::max();
+                double part_max = 0;
+                size_t prev = 0;
+                for (size_t i = 0; i <= splits.size(); ++i) {
+                    size_t next = i < splits.size() ? rank_of(splits[i]) : sorted.size();
+                    double part = static_cast<double>(next - prev) * kQuantiles / sorted.size();
+                    part_min = std::min(part_min, part);
+                    part_max = std::max(part_max, part);
+                    prev = next;
+                }
+                std::cout << "SGT - Quantiles (" << name << ") x " << kQuantiles << " took "
+                          << std::chrono::duration_cast<std::chrono::microseconds>(quantile_end - quantile_start).count()
+                          << " microseconds, " << splits.size() + 1 << " parts of " << part_min << "x to "
+                          << part_max << "x n / q" << std::endl;
+            };
+            estimate("uniform", src);
+            estimate("skewed", skewed);
+
+            for (auto & s:skewed) {
+                free(s);
+            }
+        }
+        {
+            // 页大小 (NODE_POLICY) 扫描: 页越大树越矮, 但 Node 内插入搬移的数据越多
+            // 2MB 的页单次插入需搬移约 1MB, 1M 次插入过慢, 未列入
+            auto page_size_sweep = [&](auto policy) {
+                typedef decltype(policy) Policy;
+                typedef SignatureTreeTpl<KVTrans, uint16_t, uint64_t, Policy> Tree;
+                AllocatorImpl allocator_sweep(Policy::kPageSize);
+                Tree tree_sweep(&helper, &allocator_sweep);
+
+                auto add_start = std::chrono::high_resolution_clock::now();
+                for (const auto & s:src) {
+                    tree_sweep.Add(reinterpret_cast<char *>(s), {});
+                }
+                auto add_end = std::chrono::high_resolution_clock::now();
+
+                auto get_start = std::chrono::high_resolution_clock::now();
+                for (const auto & s:src) {
+                    tree_sweep.Get(reinterpret_cast<char *>(s), nullptr);
+                }
+                auto get_end = std::chrono::high_resolution_clock::now();
+
+                size_t visit_cnt = 0;
+                auto visit_start = std::chrono::high_resolution_clock::now();
+                tree_sweep.template Visit<Tree::kForward>("", [&visit_cnt](const uint64_t &) {
+                    ++visit_cnt;
+                    return true;
+                });
+                auto visit_end = std::chrono::high_resolution_clock::now();
+                assert(visit_cnt == tree_sweep.Size());
+                static_cast<void>(visit_cnt);
+
+                std::cout << "SGT - " << Policy::kPageSize / 1024 << "KB pages (rank " << Tree::kNodeRank
+                          << ") - Add took "
+                          << std::chrono::duration_cast<std::chrono::milliseconds>(add_end - add_start).count()
+                          << " milliseconds; Get took "
+                          << std::chrono::duration_cast<std::chrono::milliseconds>(get_end - get_start).count()
+                          << " milliseconds; Visit took "
+                          << std::chrono::duration_cast<std::chrono::milliseconds>(visit_end - visit_start).count()
+                          << " milliseconds; " << allocator_sweep.records_.size() << " pages, "
+                          << allocator_sweep.records_.size() * Policy::kPageSize / (1024 * 1024) << " MB"
+                          << std::endl;
+            };
+            page_size_sweep(NodePolicy<2048>());
+            page_size_sweep(NodePolicy<4096>());
+            page_size_sweep(NodePolicy<8192>());
+            page_size_sweep(NodePolicy<16384>());
+            page_size_sweep(NodePolicy<65536>());
+        }
+        {
+            // 页的来源: malloc 的 4KB 页散落在堆中, 每个 Node 各占一个 TLB 项
+            // HugePageAllocator 的页连续地切自 2MB region, THP/hugetlb 下一个 TLB 项覆盖 512 个 Node
+            // KV 本身仍是 malloc 的 16B 字符串; 各方案均经 Allocator::Base() 换算地址, 开销相同
+            DtlbMissCounter dtlb;
+            HelperTpl<RelativeKVTrans> helper_hp;
+            auto hugepage_bench = [&](const char * name, Allocator * allocator_hp) {
+                SignatureTreeTpl<RelativeKVTrans> tree_hp(&helper_hp, allocator_hp);
+                auto add_start = std::chrono::high_resolution_clock::now();
+                for (const auto & s:src) {
+                    tree_hp.Add(reinterpret_cast<char *>(s), {});
+                }
+                auto add_end = std::chrono::high_resolution_clock::now();
+
+                dtlb.Start();
+                auto get_start = std::chrono::high_resolution_clock::now();
+                for (const auto & s:src) {
+                    tree_hp.Get(reinterpret_cast<char *>(s), nullptr);
+                }
+                auto get_end = std::chrono::high_resolution_clock::now();
+                uint64_t misses = dtlb.Stop();
+
+                auto get_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(get_end - get_start).count();
+                std::cout << "SGT - " << name << " - Add took "
+                          << std::chrono::duration_cast<std::chrono::milliseconds>(add_end - add_start).count()
+                          << " milliseconds; Get took " << get_ns / 1000000 << " milliseconds, "
+                          << get_ns / static_cast<int64_t>(src.size()) << " ns/op; dTLB load misses ";
+                if (dtlb.Available()) {
+                    std::cout << static_cast<double>(misses) / src.size() << "/op";
+                } else {
+                    std::cout << "n/a";
+                }
+                std::cout << std::endl;
+            };
+            {
+                AllocatorImpl allocator_hp;
+                hugepage_bench("malloc pages", &allocator_hp);
+            }
+            for (auto mode:{HugePageMode::kNone, HugePageMode::kTransparent, HugePageMode::kHugeTlb}) {
+                static const char * names[] = {"HugePageAllocator (4KB pages)",
+                                               "HugePageAllocator (THP)",
+                                               "HugePageAllocator (hugetlb)"};
+                try {
+                    HugePageAllocator allocator_hp(mode);
+                    hugepage_bench(names[static_cast<int>(mode)], &allocator_hp);
+                } catch (const std::system_error & e) {
+                    std::cout << "SGT - " << names[static_cast<int>(mode)] << " - skipped: " << e.what()
+                              << std::endl;
+                }
+            }
+            // 在所有 NUMA 节点间交错; 单节点机器上与绑定无异
+            try {
+                HugePageAllocator allocator_hp(HugePageMode::kTransparent, HugePageAllocator::kRegion2MB,
+                                               NumaPolicy::kNumaInterleave, UINT64_MAX);
+                hugepage_bench("HugePageAllocator (THP, interleaved)", &allocator_hp);
+            } catch (const std::system_error & e) {
+                std::cout << "SGT - HugePageAllocator (THP, interleaved) - skipped: " << e.what() << std::endl;
+            }
+        }
         {
             TIME_START;
             for (const auto & s:src) {
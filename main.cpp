@@ -4,6 +4,15 @@ namespace sgt {
     namespace sig_tree_test {
         void Run();
     }
+    namespace sig_tree_olc_test {
+        void Run();
+    }
+    namespace sig_tree_cow_test {
+        void Run();
+    }
+    namespace sig_tree_count_test {
+        void Run();
+    }
     namespace sig_tree_bench {
         void Run();
     }
@@ -13,6 +22,9 @@ using namespace sgt;
 
 int main() {
     sig_tree_test::Run();
+    sig_tree_olc_test::Run();
+    sig_tree_cow_test::Run();
+    sig_tree_count_test::Run();
     sig_tree_bench::Run();
     std::cout << "Done." << std::endl;
     return 0;
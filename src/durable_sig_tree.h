@@ -0,0 +1,120 @@
+#pragma once
+#ifndef SIG_TREE_DURABLE_SIG_TREE_H
+#define SIG_TREE_DURABLE_SIG_TREE_H
+
+/*
+ * 崩溃一致的持久化签名树
+ *
+ * 页经私有映射的 MmapAllocator 分配, 文件只在 Checkpoint 时整体更新, 永远不会看到半个 NodeSplit/NodeMerge
+ * 检查点之后的 Add/Del 先写入 WriteAheadLog, 打开时在检查点之上按 lsn 重放
+ * 每 group_size 次写操作共享一次 fsync, Commit 立即持久化此前全部操作
+ *
+ * 重放会再次调用 Helper::Add, Helper 须能由 (k, v) 重新得到 KV_REP
+ * 接口不是线程安全的, 与 SignatureTreeTpl 相同
+ */
+
+#include "mmap_allocator.h"
+#include "sig_tree.h"
+#include "wal.h"
+
+namespace sgt {
+    template<
+            typename KV_TRANS,
+            typename K_DIFF = uint16_t,
+            typename KV_REP = uint64_t,
+            typename NODE_POLICY = DefaultNodePolicy>
+    class DurableSignatureTreeTpl {
+    public:
+        typedef SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY> Tree;
+        typedef typename Tree::Helper Helper;
+        typedef MmapAllocatorTpl<NODE_POLICY> MmapAllocator;
+
+    private:
+        MmapAllocator * const allocator_;
+        WriteAheadLog log_;
+        Tree tree_;
+        const size_t group_size_;
+        size_t pending_ = 0;
+
+    public:
+        // allocator 须以 private_mapping 打开
+        DurableSignatureTreeTpl(Helper * helper, MmapAllocator * allocator, const char * log_path,
+                                size_t group_size = 128)
+                : allocator_(allocator),
+                  log_(log_path),
+                  tree_(allocator->RootOffset() != 0
+                        ? Tree(helper, allocator, allocator->RootOffset())
+                        : Tree(helper, allocator)),
+                  group_size_(group_size) {
+            allocator_->SetRootOffset(tree_.RootOffset());
+            log_.Replay(allocator_->CheckpointLsn(), [this](uint8_t type, const Slice & k, const Slice & v) {
+                if (type == WriteAheadLog::kAdd) {
+                    tree_.Add(k, v);
+                } else {
+                    assert(type == WriteAheadLog::kDel);
+                    tree_.Del(k);
+                }
+            });
+        }
+
+        ~DurableSignatureTreeTpl() {
+            log_.SyncAll();
+        }
+
+        DurableSignatureTreeTpl(const DurableSignatureTreeTpl &) = delete;
+
+        DurableSignatureTreeTpl & operator=(const DurableSignatureTreeTpl &) = delete;
+
+    public:
+        bool Get(const Slice & k, std::string * v) const {
+            return tree_.Get(k, v);
+        }
+
+        bool Add(const Slice & k, const Slice & v) {
+            Log(WriteAheadLog::kAdd, k, v);
+            return tree_.Add(k, v);
+        }
+
+        bool Del(const Slice & k) {
+            Log(WriteAheadLog::kDel, k, {});
+            return tree_.Del(k);
+        }
+
+        size_t Size() const {
+            return tree_.Size();
+        }
+
+        // bool(* visitor)(const KV_REP & rep)
+        template<bool BACKWARD, typename VISITOR>
+        void Visit(const Slice & target, VISITOR && visitor) const {
+            tree_.template Visit<BACKWARD>(target, std::forward<VISITOR>(visitor));
+        }
+
+        // 此前的全部操作在返回后持久
+        void Commit() {
+            log_.SyncAll();
+            pending_ = 0;
+        }
+
+        // 将内存中的页写成新的检查点并清空日志, 代价与文件大小成正比
+        void Checkpoint() {
+            log_.SyncAll();
+            allocator_->Checkpoint(log_.LastLsn());
+            log_.Reset();
+            pending_ = 0;
+        }
+
+        const Tree & GetTree() const { return tree_; }
+
+    private:
+        void Log(uint8_t type, const Slice & k, const Slice & v) {
+            uint64_t lsn = log_.Append(type, k, v);
+            if (++pending_ >= group_size_) {
+                log_.Sync(lsn);
+                pending_ = 0;
+            }
+        }
+    };
+}
+
+#endif //SIG_TREE_DURABLE_SIG_TREE_H
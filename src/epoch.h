@@ -0,0 +1,147 @@
+#pragma once
+#ifndef SIG_TREE_EPOCH_H
+#define SIG_TREE_EPOCH_H
+
+/*
+ * 基于 epoch 的页回收
+ *
+ * 读者进入/离开 epoch, 退役的页先在线程槽中攒批, 批满后挂到当前 epoch 的链表上
+ * 全局 epoch 从 e 推进到 e + 1 要求所有槽在 e - 1 上没有活跃读者
+ * 于是 epoch e - 1 退役的页在推进到 e + 1 时已无人可见, 交还 Allocator
+ */
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "allocator.h"
+
+namespace sgt {
+    class EpochManager {
+    public:
+        enum {
+            kSlotNum = 64,
+            kBatchSize = 64
+        };
+
+        class Guard {
+        private:
+            EpochManager * const manager_;
+            const size_t slot_;
+            const size_t bucket_;
+
+        public:
+            explicit Guard(EpochManager * manager)
+                    : manager_(manager),
+                      slot_(ThreadSlot()),
+                      bucket_(manager->Enter(slot_)) {}
+
+            ~Guard() { manager_->Leave(slot_, bucket_); }
+
+            Guard(const Guard &) = delete;
+
+            Guard & operator=(const Guard &) = delete;
+        };
+
+    private:
+        struct alignas(64) Slot {
+            std::array<std::atomic<uint32_t>, 3> actives{};
+            std::mutex mutex;
+            std::vector<size_t> pending;
+        };
+
+        Allocator * const allocator_;
+        std::atomic<uint64_t> epoch_{0};
+        std::array<Slot, kSlotNum> slots_;
+        std::mutex mutex_; // 保护 limbo_ 与 epoch 推进
+        std::array<std::vector<size_t>, 3> limbo_;
+
+    public:
+        explicit EpochManager(Allocator * allocator) : allocator_(allocator) {}
+
+        // 析构时不应再有读者
+        ~EpochManager() { Reclaim(); }
+
+        EpochManager(const EpochManager &) = delete;
+
+        EpochManager & operator=(const EpochManager &) = delete;
+
+    public:
+        // 页已从树上摘除, 但可能仍有读者持有其指针
+        void Retire(size_t offset) {
+            Slot & slot = slots_[ThreadSlot()];
+            std::vector<size_t> batch;
+            {
+                std::lock_guard<std::mutex> lock(slot.mutex);
+                slot.pending.emplace_back(offset);
+                if (slot.pending.size() < kBatchSize) {
+                    return;
+                }
+                batch.swap(slot.pending);
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto & bucket = limbo_[epoch_.load(std::memory_order_relaxed) % 3];
+            bucket.insert(bucket.end(), batch.begin(), batch.end());
+            TryAdvance();
+        }
+
+        // 立即归还所有退役页, 调用时不得有并发访问
+        void Reclaim() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto & slot:slots_) {
+                std::lock_guard<std::mutex> slot_lock(slot.mutex);
+                FreePages(&slot.pending);
+            }
+            for (auto & bucket:limbo_) {
+                FreePages(&bucket);
+            }
+        }
+
+    private:
+        size_t Enter(size_t slot) {
+            while (true) {
+                uint64_t epoch = epoch_.load(std::memory_order_seq_cst);
+                auto & active = slots_[slot].actives[epoch % 3];
+                active.fetch_add(1, std::memory_order_seq_cst);
+                if (epoch_.load(std::memory_order_seq_cst) == epoch) {
+                    return epoch % 3;
+                }
+                active.fetch_sub(1, std::memory_order_release);
+            }
+        }
+
+        void Leave(size_t slot, size_t bucket) {
+            slots_[slot].actives[bucket].fetch_sub(1, std::memory_order_release);
+        }
+
+        // 持有 mutex_
+        void TryAdvance() {
+            uint64_t epoch = epoch_.load(std::memory_order_relaxed);
+            size_t prev = (epoch + 2) % 3; // epoch - 1
+            for (const auto & slot:slots_) {
+                if (slot.actives[prev].load(std::memory_order_seq_cst) != 0) {
+                    return;
+                }
+            }
+            epoch_.store(epoch + 1, std::memory_order_seq_cst);
+            FreePages(&limbo_[prev]);
+        }
+
+        void FreePages(std::vector<size_t> * pages) {
+            for (size_t offset:*pages) {
+                allocator_->FreePage(offset);
+            }
+            pages->clear();
+        }
+
+        static size_t ThreadSlot() {
+            static std::atomic<size_t> next{0};
+            thread_local size_t id = next.fetch_add(1, std::memory_order_relaxed);
+            return id % kSlotNum;
+        }
+    };
+}
+
+#endif //SIG_TREE_EPOCH_H
@@ -0,0 +1,217 @@
+#pragma once
+#ifndef SIG_TREE_HUGEPAGE_ALLOCATOR_H
+#define SIG_TREE_HUGEPAGE_ALLOCATOR_H
+
+/*
+ * 基于大页的内存 Allocator
+ *
+ * 预留一大段按 region 对齐的虚拟地址, 再按 region (2MB / 1GB) 逐段提交
+ * Base() 从不改变, offset 跨 Grow() 稳定, 也满足 SGT_OPTIMISTIC_LOCK 对 Base() 的要求
+ * 空闲页的前 8 字节存放下一个空闲页的 offset, 页不归还给系统
+ *
+ * kHugeTlb: MAP_HUGETLB, 需事先预留大页 (vm.nr_hugepages 或 hugepages-1048576kB), 不足时 Grow() 抛出 system_error
+ * kTransparent: 匿名映射 + madvise(MADV_HUGEPAGE), 由 THP 在缺页时分配大页
+ * kNone: 普通页, 与 malloc 的页对照
+ *
+ * NUMA 策略在 region 提交后、首次访问前通过 mbind 设置, 之后缺页按策略分配
+ * kNumaBind 绑定到 node_mask 中的节点, kNumaInterleave 在其中按页 (大页) 交错
+ *
+ * 与 MmapAllocator 相同, 非线程安全, 由树 (或分片) 的锁保护
+ */
+
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include "allocator.h"
+#include "page_size.h"
+
+namespace sgt {
+    enum class HugePageMode {
+        kNone,
+        kTransparent,
+        kHugeTlb,
+    };
+
+    enum class NumaPolicy {
+        kNumaDefault, // 首次访问的 CPU 所在节点
+        kNumaBind,
+        kNumaInterleave,
+    };
+
+    template<typename NODE_POLICY = DefaultNodePolicy>
+    class HugePageAllocatorTpl : public Allocator {
+    public:
+        enum : uint64_t {
+            kPageSize = NODE_POLICY::kPageSize,
+            kRegion2MB = 1 << 21,
+            kRegion1GB = 1 << 30,
+            kMaxGrowSize = 1 << 30,
+            kDefaultReserveSize = static_cast<uint64_t>(1) << 36 // 64GB
+        };
+
+    private:
+        const HugePageMode mode_;
+        const size_t region_size_;
+        const NumaPolicy numa_policy_;
+        const uint64_t node_mask_;
+        char * base_ = nullptr;
+        size_t reserve_size_;
+        size_t committed_size_ = 0;
+        size_t used_size_ = 0;
+        size_t free_head_ = SIZE_MAX; // SIZE_MAX 表示空, offset 0 是合法的页
+
+    public:
+        // region_size 须为 2 的幂且是页大小的倍数, kHugeTlb 下还须是系统支持的大页大小
+        // node_mask 第 i 位表示 NUMA 节点 i, kNumaDefault 时忽略
+        explicit HugePageAllocatorTpl(HugePageMode mode = HugePageMode::kTransparent,
+                                      size_t region_size = kRegion2MB,
+                                      NumaPolicy numa_policy = NumaPolicy::kNumaDefault,
+                                      uint64_t node_mask = 0,
+                                      size_t reserve_size = kDefaultReserveSize)
+                : mode_(mode),
+                  region_size_(region_size),
+                  numa_policy_(numa_policy),
+                  node_mask_(node_mask),
+                  reserve_size_(reserve_size) {
+            if (region_size_ < kPageSize || (region_size_ & (region_size_ - 1)) != 0) {
+                throw std::invalid_argument("region size must be a power of 2 no less than page size");
+            }
+            if (numa_policy_ != NumaPolicy::kNumaDefault && node_mask_ == 0) {
+                throw std::invalid_argument("empty NUMA node mask");
+            }
+            reserve_size_ = std::max(reserve_size_ - reserve_size_ % region_size_, region_size_);
+
+            // 多预留一个 region 用于对齐, 大页映射的地址须按大页大小对齐
+            void * reserved = mmap(nullptr, reserve_size_ + region_size_, PROT_NONE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (reserved == MAP_FAILED) {
+                throw std::system_error(errno, std::generic_category(), "mmap");
+            }
+            auto addr = reinterpret_cast<uintptr_t>(reserved);
+            uintptr_t aligned = (addr + region_size_ - 1) & ~(region_size_ - 1);
+            if (aligned != addr) {
+                munmap(reserved, aligned - addr);
+            }
+            munmap(reinterpret_cast<void *>(aligned + reserve_size_), region_size_ - (aligned - addr));
+            base_ = reinterpret_cast<char *>(aligned);
+
+            try {
+                Commit(region_size_);
+            } catch (const std::system_error &) {
+                munmap(base_, reserve_size_);
+                throw;
+            }
+        }
+
+        ~HugePageAllocatorTpl() override {
+            munmap(base_, reserve_size_);
+        }
+
+        HugePageAllocatorTpl(const HugePageAllocatorTpl &) = delete;
+
+        HugePageAllocatorTpl & operator=(const HugePageAllocatorTpl &) = delete;
+
+    public:
+        void * Base() override {
+            return base_;
+        }
+
+        size_t AllocatePage() override {
+            if (free_head_ != SIZE_MAX) {
+                size_t offset = free_head_;
+                memcpy(&free_head_, base_ + offset, sizeof(free_head_));
+                return offset;
+            }
+            if (used_size_ + kPageSize > committed_size_) {
+                throw AllocatorFullException();
+            }
+            size_t offset = used_size_;
+            used_size_ += kPageSize;
+            return offset;
+        }
+
+        void FreePage(size_t offset) override {
+            assert(offset % kPageSize == 0 && offset < used_size_);
+            memcpy(base_ + offset, &free_head_, sizeof(free_head_));
+            free_head_ = offset;
+        }
+
+        // 已提交大小按倍增扩展, 单次至多 kMaxGrowSize, 且为 region 的整数倍
+        // 新 region 紧接在已提交部分之后, Base() 与已有 offset 均不变
+        void Grow() override {
+            size_t grow_size = std::min<size_t>(committed_size_, kMaxGrowSize);
+            grow_size = std::max(grow_size - grow_size % region_size_, region_size_);
+            if (committed_size_ + grow_size > reserve_size_) {
+                throw std::system_error(ENOMEM, std::generic_category(), "hugepage allocator reserve exhausted");
+            }
+            Commit(grow_size);
+        }
+
+    public:
+        size_t CommittedSize() const { return committed_size_; }
+
+        size_t UsedSize() const { return used_size_; }
+
+        HugePageMode Mode() const { return mode_; }
+
+    private:
+        // 在预留空间内提交 [committed_size_, committed_size_ + size)
+        void Commit(size_t size) {
+            char * addr = base_ + committed_size_;
+            int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED;
+            if (mode_ == HugePageMode::kHugeTlb) {
+                // 大页大小编码在 MAP_HUGE_SHIFT 之上, 值为 log2(region_size_)
+                flags |= MAP_HUGETLB | (__builtin_ctzll(region_size_) << MAP_HUGE_SHIFT);
+            }
+            void * p = mmap(addr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+            if (p == MAP_FAILED) {
+                int err = errno;
+                Unreserve(addr, size);
+                throw std::system_error(err, std::generic_category(), "mmap");
+            }
+            if (mode_ == HugePageMode::kTransparent && madvise(addr, size, MADV_HUGEPAGE) != 0) {
+                int err = errno;
+                Unreserve(addr, size);
+                throw std::system_error(err, std::generic_category(), "madvise");
+            }
+            if (numa_policy_ != NumaPolicy::kNumaDefault) {
+                int mode = numa_policy_ == NumaPolicy::kNumaBind ? MPOL_BIND : MPOL_INTERLEAVE;
+                // maxnode 比掩码位数多 1, 内核会先减 1
+                if (syscall(SYS_mbind, addr, size, mode, &node_mask_, sizeof(node_mask_) * 8 + 1, 0) != 0) {
+                    int err = errno;
+                    Unreserve(addr, size);
+                    throw std::system_error(err, std::generic_category(), "mbind");
+                }
+            }
+#ifdef MADV_POPULATE_WRITE
+            // hugetlb 的预留是全局的, 绑定的节点上大页不足时缺页会触发 SIGBUS
+            // 预先填充, 使之变为此处的错误返回
+            if (mode_ == HugePageMode::kHugeTlb && madvise(addr, size, MADV_POPULATE_WRITE) != 0) {
+                int err = errno;
+                Unreserve(addr, size);
+                throw std::system_error(err, std::generic_category(), "madvise");
+            }
+#endif
+            committed_size_ += size;
+        }
+
+        // 提交失败时恢复为 PROT_NONE 的预留, 避免在预留空间内留下空洞
+        void Unreserve(char * addr, size_t size) {
+            mmap(addr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+        }
+    };
+
+    typedef HugePageAllocatorTpl<> HugePageAllocator;
+}
+
+#endif //SIG_TREE_HUGEPAGE_ALLOCATOR_H
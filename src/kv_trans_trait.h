@@ -40,6 +40,8 @@ namespace sgt {
     SGT_CHECK_EXPR(has_is_packed, T::IsPacked);
 
     SGT_CHECK_EXPR(has_base, T::Base);
+
+    SGT_CHECK_EXPR(has_prefetch, T::Prefetch);
 }
 
 #endif //SIG_TREE_KV_TRANS_TRAIT_H
@@ -0,0 +1,281 @@
+#pragma once
+#ifndef SIG_TREE_MMAP_ALLOCATOR_H
+#define SIG_TREE_MMAP_ALLOCATOR_H
+
+/*
+ * 基于 file-backed mmap 的持久化 Allocator
+ *
+ * 预留一大段虚拟地址, 文件在其中原地扩展, Base() 仅在预留空间耗尽时改变
+ * 文件首页为超级块, 记录已用大小、空闲页链表头与 root offset
+ * 空闲页的前 8 字节存放下一个空闲页的 offset, 链表整体位于文件内
+ *
+ * 重新打开已有文件: SignatureTreeTpl(helper, &allocator, allocator.RootOffset())
+ *
+ * 私有映射 (private_mapping) 下修改只留在内存, 文件始终停留在上一个检查点
+ * Checkpoint 将整个映射写入临时文件再 rename 覆盖, 配合 wal.h 的重做日志实现崩溃一致
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#include "allocator.h"
+#include "page_size.h"
+
+namespace sgt {
+    // 页大小取自 NODE_POLICY, 须与树的 NODE_POLICY 相同, 记录在超级块中, 重新打开时校验
+    template<typename NODE_POLICY = DefaultNodePolicy>
+    class MmapAllocatorTpl : public Allocator {
+    public:
+        enum : uint64_t {
+            kMagic = 0x5347545245450002, // "SGTREE" + 版本
+            kPageSize = NODE_POLICY::kPageSize,
+            kInitSize = kPageSize * 16,
+            kMaxGrowSize = 1 << 30,
+            kDefaultReserveSize = static_cast<uint64_t>(1) << 36 // 64GB
+        };
+
+    private:
+        struct Superblock {
+            uint64_t magic;
+            uint64_t page_size;
+            uint64_t used_size;
+            uint64_t free_head; // 0 表示空
+            uint64_t root_offset; // 0 表示未记录
+            uint64_t checkpoint_lsn; // 检查点包含的最后一条日志
+        };
+        static_assert(sizeof(Superblock) <= kPageSize);
+
+        const std::string path_;
+        const bool private_mapping_;
+        int fd_ = -1;
+        char * base_ = nullptr;
+        size_t reserve_size_;
+        size_t file_size_ = 0;
+
+    public:
+        // 文件不存在时创建
+        explicit MmapAllocatorTpl(const char * path, size_t reserve_size = kDefaultReserveSize,
+                                  bool private_mapping = false)
+                : path_(path),
+                  private_mapping_(private_mapping),
+                  reserve_size_(reserve_size) {
+            fd_ = open(path, O_RDWR | O_CREAT, 0644);
+            if (fd_ < 0) {
+                throw std::system_error(errno, std::generic_category(), path);
+            }
+
+            struct stat st{};
+            if (fstat(fd_, &st) != 0) {
+                int err = errno;
+                close(fd_);
+                throw std::system_error(err, std::generic_category(), path);
+            }
+            file_size_ = static_cast<size_t>(st.st_size);
+
+            bool create = (file_size_ == 0);
+            if (create) {
+                // 超级块直接写入文件, 私有映射下从未做过检查点的文件也能重新打开
+                Superblock sb = {kMagic, kPageSize, kPageSize, 0, 0, 0};
+                Truncate(kInitSize);
+                if (pwrite(fd_, &sb, sizeof(sb), 0) != static_cast<ssize_t>(sizeof(sb)) || fsync(fd_) != 0) {
+                    int err = errno;
+                    close(fd_);
+                    throw std::system_error(err, std::generic_category(), path);
+                }
+            } else if (file_size_ % kPageSize != 0 || file_size_ < kPageSize) {
+                close(fd_);
+                throw std::runtime_error("corrupted sig_tree file");
+            }
+            if (reserve_size_ < file_size_) {
+                reserve_size_ = file_size_;
+            }
+            try {
+                Map();
+            } catch (const std::system_error &) {
+                close(fd_);
+                throw;
+            }
+
+            Superblock * sb = GetSuperblock();
+            if (sb->magic != kMagic || sb->page_size != kPageSize || sb->used_size > file_size_) {
+                munmap(base_, reserve_size_);
+                close(fd_);
+                throw std::runtime_error("incompatible sig_tree file");
+            }
+        }
+
+        ~MmapAllocatorTpl() override {
+            msync(base_, file_size_, MS_SYNC);
+            munmap(base_, reserve_size_);
+            close(fd_);
+        }
+
+        MmapAllocatorTpl(const MmapAllocatorTpl &) = delete;
+
+        MmapAllocatorTpl & operator=(const MmapAllocatorTpl &) = delete;
+
+    public:
+        void * Base() override {
+            return base_;
+        }
+
+        size_t AllocatePage() override {
+            Superblock * sb = GetSuperblock();
+            if (sb->free_head != 0) {
+                size_t offset = sb->free_head;
+                memcpy(&sb->free_head, base_ + offset, sizeof(sb->free_head));
+                return offset;
+            }
+            if (sb->used_size + kPageSize > file_size_) {
+                throw AllocatorFullException();
+            }
+            size_t offset = sb->used_size;
+            sb->used_size += kPageSize;
+            return offset;
+        }
+
+        void FreePage(size_t offset) override {
+            assert(offset != 0 && offset % kPageSize == 0 && offset < GetSuperblock()->used_size);
+            Superblock * sb = GetSuperblock();
+            memcpy(base_ + offset, &sb->free_head, sizeof(sb->free_head));
+            sb->free_head = offset;
+        }
+
+        // 文件按倍增扩展, 单次至多 kMaxGrowSize
+        // 预留空间不足时整体重新映射, Base() 随之改变
+        void Grow() override {
+            size_t old_size = file_size_;
+            size_t new_size = old_size + std::min<size_t>(old_size, kMaxGrowSize);
+            Truncate(new_size);
+            if (new_size <= reserve_size_) {
+                void * p = mmap(base_ + old_size, new_size - old_size, PROT_READ | PROT_WRITE,
+                                MapFlags() | MAP_FIXED, fd_, static_cast<off_t>(old_size));
+                if (p == MAP_FAILED) {
+                    throw std::system_error(errno, std::generic_category(), "mmap");
+                }
+            } else {
+                // 私有映射上未写回的修改须搬到新位置
+                std::string dirty;
+                if (private_mapping_) {
+                    dirty.assign(base_, old_size);
+                }
+                munmap(base_, reserve_size_);
+                reserve_size_ = std::max(reserve_size_ * 2, new_size);
+                Map();
+                if (private_mapping_) {
+                    memcpy(base_, dirty.data(), old_size);
+                }
+            }
+        }
+
+    public:
+        size_t RootOffset() const { return GetSuperblock()->root_offset; }
+
+        void SetRootOffset(size_t offset) { GetSuperblock()->root_offset = offset; }
+
+        // 将脏页写回文件
+        void Sync() {
+            if (msync(base_, file_size_, MS_SYNC) != 0) {
+                throw std::system_error(errno, std::generic_category(), "msync");
+            }
+        }
+
+        size_t FileSize() const { return file_size_; }
+
+        uint64_t CheckpointLsn() const { return GetSuperblock()->checkpoint_lsn; }
+
+        // 仅用于私有映射, 调用时树上不得有进行中的操作
+        // 先写临时文件并 fsync, 再 rename 覆盖原文件, 任意时刻崩溃都只会看到某个完整的检查点
+        void Checkpoint(uint64_t lsn) {
+            assert(private_mapping_);
+            GetSuperblock()->checkpoint_lsn = lsn;
+
+            std::string tmp_path = path_ + ".ckpt";
+            int fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                throw std::system_error(errno, std::generic_category(), tmp_path);
+            }
+            for (size_t written = 0; written < file_size_;) {
+                ssize_t n = pwrite(fd, base_ + written, file_size_ - written, static_cast<off_t>(written));
+                if (n < 0) {
+                    int err = errno;
+                    close(fd);
+                    throw std::system_error(err, std::generic_category(), "pwrite");
+                }
+                written += static_cast<size_t>(n);
+            }
+            if (fsync(fd) != 0 || rename(tmp_path.c_str(), path_.c_str()) != 0) {
+                int err = errno;
+                close(fd);
+                throw std::system_error(err, std::generic_category(), tmp_path);
+            }
+            SyncDir();
+
+            // 在原地址上重新映射新文件, 丢弃已写回的私有页
+            close(fd_);
+            fd_ = fd;
+            void * p = mmap(base_, file_size_, PROT_READ | PROT_WRITE, MapFlags() | MAP_FIXED, fd_, 0);
+            if (p == MAP_FAILED) {
+                throw std::system_error(errno, std::generic_category(), "mmap");
+            }
+        }
+
+    private:
+        Superblock * GetSuperblock() const {
+            return reinterpret_cast<Superblock *>(base_);
+        }
+
+        void Truncate(size_t size) {
+            if (ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+                throw std::system_error(errno, std::generic_category(), "ftruncate");
+            }
+            file_size_ = size;
+        }
+
+        // 预留 reserve_size_ 的地址空间, 再将文件映射到其头部
+        void Map() {
+            void * reserved = mmap(nullptr, reserve_size_, PROT_NONE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (reserved == MAP_FAILED) {
+                throw std::system_error(errno, std::generic_category(), "mmap");
+            }
+            void * p = mmap(reserved, file_size_, PROT_READ | PROT_WRITE,
+                            MapFlags() | MAP_FIXED, fd_, 0);
+            if (p == MAP_FAILED) {
+                int err = errno;
+                munmap(reserved, reserve_size_);
+                throw std::system_error(err, std::generic_category(), "mmap");
+            }
+            base_ = static_cast<char *>(p);
+        }
+
+        int MapFlags() const {
+            return private_mapping_ ? MAP_PRIVATE : MAP_SHARED;
+        }
+
+        void SyncDir() {
+            size_t pos = path_.find_last_of('/');
+            std::string dir = pos == std::string::npos ? "." : path_.substr(0, pos + 1);
+            int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+            if (fd >= 0) {
+                fsync(fd);
+                close(fd);
+            }
+        }
+    };
+
+    typedef MmapAllocatorTpl<> MmapAllocator;
+}
+
+#endif //SIG_TREE_MMAP_ALLOCATOR_H
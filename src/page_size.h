@@ -2,8 +2,20 @@
 #ifndef SIG_TREE_PAGE_SIZE_H
 #define SIG_TREE_PAGE_SIZE_H
 
+#include <cstddef>
+
 namespace sgt {
     constexpr unsigned int kPageSize = 4096; // 4KB
+
+    // SignatureTreeTpl 的 Node 策略: 每个 Node 占一页, kNodeRank 由页大小推出
+    // 页越大树越矮, 但 Node 内插入/删除搬移的数据越多; Allocator 分配的页须不小于 PAGE_SIZE
+    // 页过小 (约 2KB 以下) 时 Node 尾部不足以容纳 SSE 的越界读取, 编译期报错
+    template<size_t PAGE_SIZE>
+    struct NodePolicy {
+        static constexpr size_t kPageSize = PAGE_SIZE;
+    };
+
+    typedef NodePolicy<kPageSize> DefaultNodePolicy;
 }
 
 #endif //SIG_TREE_PAGE_SIZE_H
@@ -0,0 +1,154 @@
+#pragma once
+#ifndef SIG_TREE_SHARDED_SIG_TREE_H
+#define SIG_TREE_SHARDED_SIG_TREE_H
+
+/*
+ * 分片签名树
+ *
+ * 将 Key 空间切分给 N 棵互相独立的 SignatureTreeTpl, 每片拥有自己的锁与 Allocator
+ * 哈希分片: 仅适合点查, Visit 逐片访问, 不保证顺序
+ * 范围分片: 按 split_points 切分, Visit 跨片按 Key 有序
+ *
+ * 不同分片的 Add/Del 会并发调用 Helper, Helper 须线程安全
+ */
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include "sig_tree.h"
+
+namespace sgt {
+    template<
+            typename KV_TRANS,
+            typename K_DIFF = uint16_t,
+            typename KV_REP = uint64_t,
+            typename NODE_POLICY = DefaultNodePolicy>
+    class ShardedSignatureTreeTpl {
+    public:
+        typedef SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY> Tree;
+        typedef typename Tree::Helper Helper;
+
+    private:
+        struct Shard {
+            mutable std::shared_mutex mutex_;
+            Tree tree_;
+
+            Shard(Helper * helper, Allocator * allocator) : tree_(helper, allocator) {}
+        };
+
+        std::vector<std::unique_ptr<Shard>> shards_;
+        const std::vector<std::string> split_points_;
+
+    public:
+        // split_points 为空时按哈希分片, 否则须升序且 allocators.size() == split_points.size() + 1
+        // Key >= split_points[i] 的落在第 i + 1 片
+        ShardedSignatureTreeTpl(Helper * helper, const std::vector<Allocator *> & allocators,
+                                std::vector<std::string> split_points = {})
+                : split_points_(std::move(split_points)) {
+            assert(!allocators.empty());
+            assert(split_points_.empty() || split_points_.size() + 1 == allocators.size());
+            assert(std::is_sorted(split_points_.cbegin(), split_points_.cend()));
+            for (Allocator * allocator:allocators) {
+                shards_.emplace_back(std::make_unique<Shard>(helper, allocator));
+            }
+        }
+
+        ShardedSignatureTreeTpl(const ShardedSignatureTreeTpl &) = delete;
+
+        ShardedSignatureTreeTpl & operator=(const ShardedSignatureTreeTpl &) = delete;
+
+    public:
+        bool Get(const Slice & k, std::string * v) const {
+            const Shard & shard = *shards_[ShardIndex(k)];
+            std::shared_lock<std::shared_mutex> lock(shard.mutex_);
+            return shard.tree_.Get(k, v);
+        }
+
+        // bool(* if_dup_callback)(KV_TRANS & trans, KV_REP & rep)
+        template<typename V = Slice, typename IF_DUP_CALLBACK = std::false_type>
+        bool Add(const Slice & k, V && v,
+                 IF_DUP_CALLBACK && if_dup_callback = {}) {
+            Shard & shard = *shards_[ShardIndex(k)];
+            std::unique_lock<std::shared_mutex> lock(shard.mutex_);
+            return shard.tree_.Add(k, std::forward<V>(v), std::forward<IF_DUP_CALLBACK>(if_dup_callback));
+        }
+
+        bool Del(const Slice & k) {
+            Shard & shard = *shards_[ShardIndex(k)];
+            std::unique_lock<std::shared_mutex> lock(shard.mutex_);
+            return shard.tree_.Del(k);
+        }
+
+        size_t Size() const {
+            size_t size = 0;
+            for (const auto & shard:shards_) {
+                std::shared_lock<std::shared_mutex> lock(shard->mutex_);
+                size += shard->tree_.Size();
+            }
+            return size;
+        }
+
+        size_t ShardNum() const { return shards_.size(); }
+
+        bool IsRangeSharded() const { return !split_points_.empty(); }
+
+        // bool(* visitor)(const KV_REP & rep)
+        // 每片在共享锁下访问, 跨片之间不是同一时刻的快照
+        template<bool BACKWARD, typename VISITOR>
+        void Visit(const Slice & target, VISITOR && visitor) const {
+            bool proceed = true;
+            auto wrapper = [&visitor, &proceed](const KV_REP & rep) {
+                return (proceed = visitor(rep));
+            };
+
+            size_t n = shards_.size();
+            if constexpr (BACKWARD) {
+                if (target.size() != 0 && IsRangeSharded()) {
+                    // 与单棵树一致, 始于首个不小于 target 的 Key, 不存在则不访问
+                    // target 之后没有 Key 的片不含起点, 起点是后续片的首个 Key
+                    size_t i = ShardIndex(target);
+                    bool started = false;
+                    for (; !started && i < n; ++i) {
+                        const Shard & shard = *shards_[i];
+                        std::shared_lock<std::shared_mutex> lock(shard.mutex_);
+                        shard.tree_.template Visit<BACKWARD>(target, [&wrapper, &started](const KV_REP & rep) {
+                            started = true;
+                            return wrapper(rep);
+                        });
+                    }
+                    // 起点所在片之前的片从各自最后一个 Key 开始
+                    for (--i; started && proceed && i-- > 0;) {
+                        const Shard & shard = *shards_[i];
+                        std::shared_lock<std::shared_mutex> lock(shard.mutex_);
+                        shard.tree_.template Visit<BACKWARD>(Slice(), wrapper);
+                    }
+                    return;
+                }
+            }
+            size_t from = target.size() == 0 || !IsRangeSharded() ? (!BACKWARD ? 0 : n - 1)
+                                                                   : ShardIndex(target);
+            for (size_t i = from; proceed && i < n; !BACKWARD ? ++i : --i) {
+                const Shard & shard = *shards_[i];
+                std::shared_lock<std::shared_mutex> lock(shard.mutex_);
+                shard.tree_.template Visit<BACKWARD>(i == from || !IsRangeSharded() ? target : Slice(), wrapper);
+            }
+        }
+
+    private:
+        size_t ShardIndex(const Slice & k) const {
+            if (!IsRangeSharded()) {
+                return SliceHasher()(k) % shards_.size();
+            }
+            return std::upper_bound(split_points_.cbegin(), split_points_.cend(), k,
+                                    [](const Slice & a, const std::string & b) {
+                                        return SliceComparator()(a, b);
+                                    }) - split_points_.cbegin();
+        }
+    };
+}
+
+#endif //SIG_TREE_SHARDED_SIG_TREE_H
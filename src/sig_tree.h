@@ -10,68 +10,144 @@
  *
  * SGT 无法区分 "abc\0\0" 与 "abc\0"
  * 解决方案: C 式字符串等
+ *
+ * 定义 SGT_OPTIMISTIC_LOCK 启用乐观锁耦合 (OLC)
+ * 每个 Node 带版本与锁字, Get/GetWithCallback 校验版本而不加锁, Add/Del 仅锁定其修改的 Node
+ * 此时 Allocator 须线程安全且 Base() 不变, Visit/Compact/Rebuild 仍需独占访问
+ * 合并释放的页经 EpochManager 延迟归还, 直到没有读者能看到它们
+ *
+ * 定义 SGT_COPY_ON_WRITE 启用写时复制快照
+ * GetSnapshot 复制 root 冻结当前版本, 此后写操作沿路径复制被快照共享的 Node
+ * 快照上的读可与写并发, 取得/释放快照视同写操作; 此时 Allocator 的 Base() 须不变
+ * 被替换的页在最后一个引用它的快照释放时归还
+ *
+ * 定义 SGT_SUBTREE_COUNT 为每个 rep 记录其下的 Key 数 (叶子为 1)
+ * Size 只读 root, Rank/Select/CountRange 各一次下降; 每页容量因此变小
+ * 写操作沿路径更新计数, MultiAdd/MultiDel/DeleteRange 退回逐个 Add/Del
  */
 
+#if defined(SGT_OPTIMISTIC_LOCK) && defined(SGT_COPY_ON_WRITE)
+#error "SGT_OPTIMISTIC_LOCK and SGT_COPY_ON_WRITE are mutually exclusive"
+#endif
+
+#if defined(SGT_OPTIMISTIC_LOCK) && defined(SGT_SUBTREE_COUNT)
+#error "SGT_OPTIMISTIC_LOCK and SGT_SUBTREE_COUNT are mutually exclusive"
+#endif
+
+#ifdef SGT_COPY_ON_WRITE
+#include <set>
+#endif
+
+#ifdef SGT_OPTIMISTIC_LOCK
+#ifndef SGT_NO_DENSE_INPUT_CACHE
+#define SGT_NO_DENSE_INPUT_CACHE // 缓存项无法与版本一同校验
+#endif
+#include "epoch.h"
+#endif
+
 #include <array>
+#include <atomic>
 #include <climits>
+#include <memory>
+#include <mutex>
 #include <tuple>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 #include "allocator.h"
+#include "autovector.h"
 #include "kv_trans_trait.h"
 #include "likely.h"
 #include "page_size.h"
 
 namespace sgt {
-    template<
-            typename KV_TRANS, // KV_REP => K, V
-            typename K_DIFF = uint16_t,
-            typename KV_REP = uint64_t>
-    class SignatureTreeTpl {
-        static_assert(is_kv_trans<KV_TRANS>::value);
-        static_assert(!std::numeric_limits<K_DIFF>::is_signed);
+    // KV 存储的接口, 只与 KV_TRANS/KV_REP 有关, 不同 K_DIFF 或 NODE_POLICY 的树可共用
+    template<typename KV_TRANS, typename KV_REP = uint64_t>
+    class SignatureTreeHelperTpl {
+    public:
+        SignatureTreeHelperTpl() = default;
+
+        virtual ~SignatureTreeHelperTpl() = default;
 
     public:
-        class Helper {
-        public:
-            Helper() = default;
+        virtual KV_REP Add(const Slice & k, const Slice & v) = 0;
 
-            virtual ~Helper() = default;
+        virtual void Del(KV_TRANS & trans) = 0;
 
-        public:
-            virtual KV_REP Add(const Slice & k, const Slice & v) = 0;
+        // MultiDel 命中的 Key 一次交回, 便于 KV 存储批量释放
+        virtual void MultiDel(KV_TRANS * transes, size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                Del(transes[i]);
+            }
+        }
 
-            virtual void Del(KV_TRANS & trans) = 0;
+        virtual KV_REP Pack(size_t offset) const = 0;
 
-            virtual KV_REP Pack(size_t offset) const = 0;
+        virtual size_t Unpack(const KV_REP & rep) const = 0;
 
-            virtual size_t Unpack(const KV_REP & rep) const = 0;
+        virtual bool IsPacked(const KV_REP & rep) const = 0;
 
-            virtual bool IsPacked(const KV_REP & rep) const = 0;
+        virtual KV_TRANS Trans(const KV_REP & rep) const = 0;
+    };
 
-            virtual KV_TRANS Trans(const KV_REP & rep) const = 0;
-        };
+    template<
+            typename KV_TRANS, // KV_REP => K, V
+            typename K_DIFF = uint16_t,
+            typename KV_REP = uint64_t,
+            typename NODE_POLICY = DefaultNodePolicy> // 页大小, 见 page_size.h
+    class SignatureTreeTpl {
+        static_assert(is_kv_trans<KV_TRANS>::value);
+        static_assert(!std::numeric_limits<K_DIFF>::is_signed);
+
+    public:
+        typedef SignatureTreeHelperTpl<KV_TRANS, KV_REP> Helper;
 
     protected:
         Helper * const helper_;
         Allocator * const allocator_;
         void * base_;
         const size_t kRootOffset;
+#ifdef SGT_OPTIMISTIC_LOCK
+        mutable EpochManager epoch_;
+#else
+        std::atomic<uint64_t> modified_{0}; // 写操作计数, 供 Iterator 判断路径是否需要核对
+#endif
+#ifdef SGT_COPY_ON_WRITE
+        std::set<uint32_t> snapshots_; // 存活快照的版本号
+        std::vector<std::tuple<size_t /* offset */, uint32_t /* born */, uint32_t /* died */>> retired_;
+#endif
 
     public:
+#ifdef SGT_COPY_ON_WRITE
+        class Snapshot;
+#endif
+
+        class Lookup;
+
+        class LookupScheduler;
+
+        class Iterator;
+
         SignatureTreeTpl(Helper * helper, Allocator * allocator);
 
         SignatureTreeTpl(Helper * helper, Allocator * allocator, size_t root_offset)
                 : helper_(helper),
                   allocator_(allocator),
                   base_(allocator->Base()),
-                  kRootOffset(root_offset) {}
+                  kRootOffset(root_offset)
+#ifdef SGT_OPTIMISTIC_LOCK
+                , epoch_(allocator)
+#endif
+        {}
 
         SignatureTreeTpl(const SignatureTreeTpl &) = delete;
 
         SignatureTreeTpl & operator=(const SignatureTreeTpl &) = delete;
 
     public:
+        // 读操作 (Get, GetWithCallback, MultiGetWithCallback, MultiGet, Visit, Size) 可由多个线程并发调用
+        // 读写之间仍需由调用方同步
         bool Get(const Slice & k, std::string * v) const;
 
         // auto(* callback)(KV_REP * rep)
@@ -84,6 +160,18 @@ namespace sgt {
         auto MultiGetWithCallback(const Slice * ks,
                                   CALLBACK && callback = {} /* [](std::array<KV_REP *, N> & reps) { return reps; } */);
 
+        // void(* callback)(size_t i, KV_REP * rep), 每个 Key 查找结束时回调, 顺序不定
+        // 同时推进 width 个查找, 完成的槽位立即换入下一个 Key (AMAC), width 至多 kMaxMultiGetWidth
+        template<typename CALLBACK>
+        void MultiGet(const Slice * ks, size_t n, CALLBACK && callback, size_t width = 16);
+
+        // void(* callback)(size_t i, Iterator & iter), iter 已定位到首个不小于 ks[i] 的 rep, 顺序不定
+        // 同 MultiGet 交错推进 width 个下降, 叶子处的 KV 比较与 crit bit 纠正也在轮转中完成
+        // KV_TRANS 提供 static void Prefetch(const KV_REP &) 时, 比较前先预取 KV 并让出一轮
+        // 与 Visit 相同, OLC 下仍需独占访问
+        template<typename CALLBACK>
+        void MultiSeek(const Slice * ks, size_t n, CALLBACK && callback, size_t width = 16) const;
+
         size_t Size() const;
 
         size_t RootOffset() const { return kRootOffset; }
@@ -104,17 +192,117 @@ namespace sgt {
                                                            std::forward<E>(expected));
         }
 
+        // 逐点有序查询, 不存在时返回 nullptr
+        // LowerBound / Ceil: 首个不小于 k 的 rep, UpperBound: 首个大于 k 的 rep, Floor: 最后一个不大于 k 的 rep
+        // 一次下降加至多一次自 root 的纠正, 不维护路径栈; 与 Visit 相同, OLC 下仍需独占访问
+        KV_REP * LowerBound(const Slice & k) { return Bound<kForward, true>(k); }
+
+        KV_REP * UpperBound(const Slice & k) { return Bound<kForward, false>(k); }
+
+        KV_REP * Floor(const Slice & k) { return Bound<kBackward, true>(k); }
+
+        KV_REP * Ceil(const Slice & k) { return LowerBound(k); }
+
+        // 并行扫描 [lo, hi), lo 为空表示自开头, hi 为空表示到末尾
+        // 自上层 Node 逐层切出与区间相交、互不相交的子树作为 part, part 编号随 Key 递增, 各 worker 在 part 内独立前进
+        // bool(* visitor)(size_t part, const KV_REP & rep), 返回 false 时结束整个扫描
+        // ORDERED 为 false 时由 num_workers 个线程 (含调用线程) 并发回调, 同一 part 内 Key 递增, 按 part 拼接即为有序结果
+        // ORDERED 为 true 时 num_workers 个线程先行扫描并缓冲, 由调用线程按 Key 顺序逐个回调
+        // 与 Visit 相同, OLC 下仍需独占访问
+        template<bool ORDERED = false, typename VISITOR>
+        void ParallelVisit(const Slice & lo, const Slice & hi, size_t num_workers, VISITOR && visitor) const;
+
+        // 以 prefix 开头的 Key 同属一段子树, 其边界 diff 的 diff_at 不小于 prefix.size()
+        // 下降一次找到这段子树, 只比较一次 Key, 之后仅在其中遍历或计数
+        // bool(* visitor)(const KV_REP & rep), Key 递增
+        template<typename VISITOR>
+        void VisitPrefix(const Slice & prefix, VISITOR && visitor) const;
+
+        size_t CountPrefix(const Slice & prefix) const;
+
+#ifdef SGT_SUBTREE_COUNT
+        // 小于 k 的 Key 数
+        size_t Rank(const Slice & k) const;
+
+        // 第 i 小 (自 0 起) 的 rep, i 不小于 Size() 时返回 nullptr
+        KV_REP * Select(size_t i);
+
+        // [lo, hi) 内的 Key 数, lo 为空表示自开头, hi 为空表示到末尾
+        size_t CountRange(const Slice & lo, const Slice & hi) const;
+#endif
+
+        // 估计 [lo, hi) 内的 Key 数, lo 为空表示自开头, hi 为空表示到末尾
+        // 两端各下降一次, 两条路径之间的叶子逐个计入; packed rep 按深度自浅至深展开至多 kEstimateExpandNodes 个 Node,
+        // 余下的按所在 Node 叶子的平均深度推算大小. 不读取 KV, 开销约为 O(height + kEstimateExpandNodes) 个 Node
+        // 定义 SGT_SUBTREE_COUNT 时即 CountRange
+        size_t EstimateRange(const Slice & lo, const Slice & hi) const;
+
+        // 随机取 k 个 rep (有放回), 按 Key 递增返回; 每个自 root 下降, 各层按子树大小加权选取, 至多读取 O(k × height) 个 Node
+        // 定义 SGT_SUBTREE_COUNT 时按精确计数, 为均匀抽样; 否则按 NodeDepthBase 推算子树大小, Key 各 bit 近似均匀时近似均匀,
+        // Key 分布偏斜 (如各前缀下的 Key 数相差悬殊) 时偏差可达数十倍
+        // rng 满足 UniformRandomBitGenerator
+        template<typename RNG>
+        std::vector<KV_REP> Sample(size_t k, RNG && rng) const;
+
+        // 将全部 Key 近似等分为 q 段的分界 rep, 第 i 个位于 i / q 处, Key 递增且互不相同 (Key 不足时少于 q - 1 个)
+        // 与 Sample 相同地按子树大小下降, 至多读取 O(q × height) 个 Node; 定义 SGT_SUBTREE_COUNT 时为精确分位
+        std::vector<KV_REP> Quantiles(size_t q) const;
+
         // bool(* if_dup_callback)(KV_TRANS & trans, KV_REP & rep)
         template<typename V = Slice, typename IF_DUP_CALLBACK = std::false_type>
         bool Add(const Slice & k, V && v,
                  IF_DUP_CALLBACK && if_dup_callback = {});
 
+        // 批量插入, 每个 Key 的语义与 Add 相同, 返回 Add 返回 true 的个数
+        // 批内按 Key 排序后流水线下降, 落在同一 Node 的插入合并为一次移动与一次 NodeBuild
+        // 无法就地合并的 Key (同一位置的多个插入、Node 已满、插入点在上层 Node) 退回逐个 Add
+        template<typename V = Slice, typename IF_DUP_CALLBACK = std::false_type>
+        size_t MultiAdd(const Slice * ks, const V * vs, size_t n,
+                        IF_DUP_CALLBACK && if_dup_callback = {});
+
         bool Del(const Slice & k);
 
+        // 批量删除, 返回删除的个数, 批内重复的 Key 只计一次
+        // 同一 Node 的命中一次移除, 每个 Node 只重建一次 pyramid、只检查一次合并
+        // 会使 Node 清空的 Key 退回逐个 Del
+        size_t MultiDel(const Slice * ks, size_t n);
+
+        // 删除 [lo, hi) 内的全部 Key, 返回删除的个数, lo 为空表示自开头, hi 为空表示到末尾
+        // 完全落在区间内的子树整体摘下, 其中的 KV 经 Helper::MultiDel 一次交回, 页最后统一归还
+        size_t DeleteRange(const Slice & lo, const Slice & hi);
+
         void Compact();
 
+        // Rebuild 的工作区, 由调用方持有并在多次 Rebuild 间复用 Page arena, 同一时刻只供一次 Rebuild 使用
+        struct RebuildContext;
+
         void Rebuild(SignatureTreeTpl * dst) const;
 
+        void Rebuild(SignatureTreeTpl * dst, RebuildContext * ctx) const;
+
+        // 以 num_threads 个线程并行重建互不相交的子树, 再在顶层拼接, ctx 用于顶层拼接
+        // dst 的页分配由内部加锁串行, Allocator 无须线程安全, 但 Base() 须不变
+        void Rebuild(SignatureTreeTpl * dst, size_t num_threads) const;
+
+        void Rebuild(SignatureTreeTpl * dst, size_t num_threads, RebuildContext * ctx) const;
+
+        // 由升序且互不重复的 (k, rep) 流自底向上建树, 调用时树须为空
+        // 与前一个 Key 相同 (含仅差末尾 '\0') 的 Key 被跳过, 其 rep 不进入树
+        // bool(* next)(Slice * k, KV_REP * rep), 返回 false 表示流结束, k 只需在下次调用前有效
+        // fill_factor 为每页的目标填充率, 留出空间可减少之后插入时的 NodeSplit
+        template<typename NEXT>
+        void BulkLoad(NEXT && next, double fill_factor = 1.0);
+
+#ifdef SGT_COPY_ON_WRITE
+        // 快照须先于树析构
+        std::unique_ptr<Snapshot> GetSnapshot();
+#endif
+
+#ifdef SGT_OPTIMISTIC_LOCK
+        // 立即归还所有退役的页, 调用时不得有并发访问
+        void ReclaimRetiredPages() { epoch_.Reclaim(); }
+#endif
+
     protected:
         enum {
             kPyramidBrickLength = 8
@@ -146,8 +334,10 @@ namespace sgt {
                     return 1;
                 } else if (SGT_UNLIKELY(rank <= 64)) {
                     return 2;
-                } else {
+                } else if (SGT_LIKELY(rank <= 512)) {
                     return 3;
+                } else {
+                    return CalcPyramidHeight(rank);
                 }
             }
         }
@@ -199,37 +389,125 @@ namespace sgt {
             std::array<KV_REP, RANK + 1> reps_;
             std::array<K_DIFF, RANK> diffs_;
             uint32_t size_ = 0;
+#ifdef SGT_SUBTREE_COUNT
+            std::array<uint32_t, RANK + 1> counts_; // 各 rep 下的 Key 数
+#endif
+#ifdef SGT_OPTIMISTIC_LOCK
+            uint32_t version_ = 0; // bit0: 锁, bit1: 已退役, 其余: 版本号
+#endif
+#ifdef SGT_COPY_ON_WRITE
+            uint32_t gen_ = 0; // 创建时的写版本号, root 上的值即当前写版本号
+#endif
 #ifndef SGT_NO_DENSE_INPUT_CACHE
             Cache cache_;
 #endif
             Pyramid pyramid_;
         };
 
-        template<size_t RANK = 1, bool UP = true>
+        // 不超过一页的最大 RANK, sizeof(NodeTpl<RANK>) 随 RANK 单调不减, 故在 [LO, HI] 内二分
+        // 只实例化选中一侧, 实例化的 NodeTpl 个数与深度均为 O(log(page size))
+        template<size_t LO = 1, size_t HI = NODE_POLICY::kPageSize / sizeof(KV_REP), bool DONE = (LO >= HI)>
         struct NodeRank {
-            enum {
-                kSize = sizeof(NodeTpl<RANK>),
-                value = kSize > kPageSize
-                        ? static_cast<int>(NodeRank<RANK - 1, false>::value)
-                        : static_cast<int>(NodeRank<RANK + 1, !(kSize > kPageSize)>::value)
+            enum : size_t {
+                kMid = (LO + HI + 1) / 2,
+                value = std::conditional_t<(sizeof(NodeTpl<kMid>) > NODE_POLICY::kPageSize),
+                        NodeRank<LO, kMid - 1>, NodeRank<kMid, HI>>::value
             };
         };
 
-        template<size_t RANK>
-        struct NodeRank<RANK, false> {
-            enum {
-                kSize = sizeof(NodeTpl<RANK>),
-                value = RANK
+        template<size_t LO, size_t HI>
+        struct NodeRank<LO, HI, true> {
+            enum : size_t {
+                value = LO
             };
         };
+        static_assert(sizeof(NodeTpl<1>) <= NODE_POLICY::kPageSize, "page too small for a Node");
 
         typedef NodeTpl<NodeRank<>::value> Node;
         static_assert(std::is_standard_layout<Node>::value &&
                       std::is_trivially_copyable<Node>::value);
 
+        // 定长页缓冲, 容量与 Node 相同
         struct Page {
-            std::vector<K_DIFF> diffs;
-            std::vector<KV_REP> reps;
+            size_t size; // reps 数, diffs 数为 size - 1
+            std::array<K_DIFF, NodeRank<>::value> diffs;
+            std::array<KV_REP, NodeRank<>::value + 1> reps;
+#ifdef SGT_SUBTREE_COUNT
+            std::array<uint32_t, NodeRank<>::value + 1> counts;
+#endif
+        };
+
+#ifdef SGT_SUBTREE_COUNT
+        static uint32_t PageCount(const Page & page) {
+            uint32_t cnt = 0;
+            for (size_t i = 0; i < page.size; ++i) {
+                cnt += page.counts[i];
+            }
+            return cnt;
+        }
+#endif
+
+    public:
+        // Rebuild/BulkLoad 的工作区, Page 取自按块分配的 arena, 用完归还空闲表
+        // arena 与各栈达到峰值后不再分配堆内存
+        struct RebuildContext {
+            enum {
+                kBlockPages = 64
+            };
+
+            std::vector<std::unique_ptr<Page[]>> blocks;
+            std::vector<Page *> free_pages;
+            std::vector<std::pair<Page *, K_DIFF>> stack; // 待合并的 Page 及其右侧的 diff, diff 自底向上递增
+            std::vector<std::pair<const Node *, size_t>> path; // 源树的遍历栈
+            std::mutex * alloc_mutex = nullptr; // 并行 Rebuild 时串行化 dst 的页分配
+            const std::unordered_map<const Node *, Page *> * built = nullptr; // 已由工作线程重建的子树
+
+            RebuildContext() {
+                AddBlock();
+                stack.reserve(64);
+                path.reserve(16);
+            }
+
+            Page * NewPage(const KV_REP & rep) {
+                if (free_pages.empty()) {
+                    AddBlock();
+                }
+                Page * page = free_pages.back();
+                free_pages.pop_back();
+                page->size = 1;
+                page->reps[0] = rep;
+#ifdef SGT_SUBTREE_COUNT
+                page->counts[0] = 1;
+#endif
+                return page;
+            }
+
+            void Recycle(Page * page) { free_pages.emplace_back(page); }
+
+            void AddBlock() {
+                blocks.emplace_back(new Page[kBlockPages]);
+                free_pages.reserve(blocks.size() * kBlockPages);
+                for (size_t i = kBlockPages; i-- > 0;) {
+                    free_pages.emplace_back(&blocks.back()[i]);
+                }
+            }
+
+            // 归还全部 Page 并清空各栈, 保留 arena 与容量供下一次复用
+            void Reset() {
+                free_pages.clear();
+                for (auto it = blocks.rbegin(); it != blocks.rend(); ++it) {
+                    for (size_t i = kBlockPages; i-- > 0;) {
+                        free_pages.emplace_back(&(*it)[i]);
+                    }
+                }
+                stack.clear();
+                path.clear();
+                alloc_mutex = nullptr;
+                built = nullptr;
+            }
+
+            // arena 的页数, 达到峰值后不再增长
+            size_t ArenaPages() const { return blocks.size() * kBlockPages; }
         };
 
     protected:
@@ -243,8 +521,31 @@ namespace sgt {
         static std::tuple<size_t /* idx */, bool /* direct */, size_t /* size */>
         FindBestMatchImpl(const Node * node, const Slice & k);
 
+        // 一次下降的结果: 最终 Node 内的匹配位置, 及其 parent 中指向它的位置
+        struct Match {
+            Node * node;
+            size_t idx;
+            bool direct;
+            size_t size;
+            Node * parent;
+            size_t parent_idx;
+            bool parent_direct;
+            size_t parent_size;
+            size_t depth;
+        };
+
+        // void(* callback)(size_t i, const Match & match), 完成顺序不定, 树须非空
+        // 同时推进 width 个下降 (AMAC), 供 MultiGet/MultiAdd/MultiDel 共用
+        template<typename CALLBACK>
+        void MultiFindBestMatch(const Slice * ks, size_t n, CALLBACK && callback, size_t width);
+
+        // void(* callback)(size_t i, const Match & match), ks 须升序, 树须非空
+        // 相邻 Key 在公共前缀之内的判定相同, 只从首个可能分叉的 Node 重新下降
+        template<typename CALLBACK>
+        void SortedFindBestMatch(const Slice * ks, size_t n, CALLBACK && callback);
+
         bool CombatInsert(const Slice & opponent, const Slice & k, KV_REP v,
-                          Node * hint, size_t hint_idx, bool hint_direct);
+                          Node * hint, size_t hint_idx, bool hint_direct, uint32_t hint_version);
 
         void NodeSplit(Node * parent);
 
@@ -253,18 +554,22 @@ namespace sgt {
 
         void NodeCompact(Node * node);
 
-        Page RebuildHeadNode(const Node * node, SignatureTreeTpl * dst,
-                             std::vector<Page> * pool) const;
+        // 按中序展开 node 下的全部 rep, 经 RebuildPushPage 自底向上合并
+        Page * RebuildSubtree(const Node * node, SignatureTreeTpl * dst, RebuildContext * ctx) const;
+
+        // 依中序送入一个 Page 及其与下一个 Page 之间的 diff, 弹出 diff 更大的栈顶并合并, 即构造笛卡尔树
+        static void RebuildPushPage(Page * page, K_DIFF diff, SignatureTreeTpl * dst,
+                                    RebuildContext * ctx, size_t capacity = kNodeRepRank);
 
-        Page RebuildInternalNode(const Node * node,
-                                 const K_DIFF * cbegin, const K_DIFF * cend, const K_DIFF * min_it,
-                                 typename Node::Pyramid & pyramid, bool direct, SignatureTreeTpl * dst,
-                                 std::vector<Page> * pool) const;
+        // 送入最后一个 Page, 合并栈中剩余的 Page
+        static Page * RebuildPopPages(Page * page, SignatureTreeTpl * dst,
+                                      RebuildContext * ctx, size_t capacity = kNodeRepRank);
 
-        static Page RebuildLRPagesToTree(Page && l, Page && r, K_DIFF diff, SignatureTreeTpl * dst,
-                                         std::vector<Page> * pool);
+        static Page * RebuildLRPagesToTree(Page * l, Page * r, K_DIFF diff, SignatureTreeTpl * dst,
+                                           RebuildContext * ctx, size_t capacity);
 
-        static size_t RebuildPageToTree(const Page & page, SignatureTreeTpl * dst);
+        static size_t RebuildPageToTree(const Page & page, SignatureTreeTpl * dst,
+                                        std::mutex * alloc_mutex = nullptr);
 
         static void RebuildPageToNode(const Page & page, Node * node);
 
@@ -273,12 +578,90 @@ namespace sgt {
 
         static void NodeRemove(Node * node, size_t idx, bool direct, size_t size);
 
+        // 移除 reps_[from, to), 两侧剩余 rep 之间的 diff 取原区间内的最小值
+        static void NodeRemoveRange(Node * node, size_t from, size_t to);
+
         static void NodeBuild(Node * node, size_t rebuild_idx = 0);
 
+        // Node 由 old_size 个 rep 增长后重建, 原先不超过 9 个 rep 时 pyramid 未建, 须从头重建
+        static void NodeBuildGrown(Node * node, size_t old_size, size_t rebuild_idx);
+
+#ifdef SGT_SUBTREE_COUNT
+        // counts_[from, to) 之和
+        static uint32_t NodeCount(const Node * node, size_t from, size_t to) {
+            uint32_t cnt = 0;
+            for (size_t i = from; i < to; ++i) {
+                cnt += node->counts_[i];
+            }
+            return cnt;
+        }
+
+        // k 已插入, 沿其路径为各上层 rep 的计数加一
+        void CountPathAdd(const Slice & k);
+#endif
+
         static size_t NodeSize(const Node * node);
 
         static bool IsNodeFull(const Node * node);
 
+        // reps_[i] 在 Node 内的分叉深度 (bit), 即与两侧相邻 rep 的最长公共前缀
+        static unsigned NodeRepDepth(const Node * node, size_t i);
+
+        // 由 Node 内叶子的平均深度推算 packed rep 的子树大小: 深度 d 处约有 2^(a - d) 个 Key, 返回 a
+        // a 取叶子平均深度减去随机 trie 中叶子深度与 log2(n) 的常数差 (约 1.33); Node 内没有叶子时返回 NaN
+        double NodeDepthBase(const Node * node) const;
+
+        // 自 root 下降至 pos[0, n) 各位置处的 rep, 回调 callback(i, rep); pos 须递增且在 [0, 1) 内, 树不能为空
+        // 各层按子树大小划分位置, 多个位置经过同一 Node 时只读取一次; 定义 SGT_SUBTREE_COUNT 时即第 floor(pos × Size()) 小的 rep
+        template<typename CALLBACK>
+        void DescendAt(const double * pos, size_t n, CALLBACK && callback) const;
+
+        // targets[from, to) 为父 Node 中以 weight 计的位置, 换算为本 Node 的位置后分派给各 rep
+        template<typename CALLBACK>
+        void NodeDescendAt(const Node * node, double weight, double * targets, size_t from, size_t to,
+                           CALLBACK && callback) const;
+
+#ifdef SGT_OPTIMISTIC_LOCK
+        enum : uint32_t {
+            kNodeLocked = 0b01,
+            kNodeObsolete = 0b10,
+            kNodeVersionStep = 0b100
+        };
+
+        // 等待写者释放, 若 Node 已退役返回 false
+        static bool NodeReadLock(const Node * node, uint32_t * version);
+
+        static bool NodeValidate(const Node * node, uint32_t version);
+
+        static bool NodeUpgradeLock(Node * node, uint32_t version);
+
+        static void NodeLock(Node * node);
+
+        static void NodeUnlock(Node * node);
+
+        static void NodeUnlockUnchanged(Node * node);
+
+        static void NodeUnlockObsolete(Node * node);
+
+        void RetirePage(size_t offset) { epoch_.Retire(offset); }
+#endif
+
+#ifdef SGT_COPY_ON_WRITE
+        uint32_t CurrentGen() const { return OffsetToMemNode(kRootOffset)->gen_; }
+
+        bool IsNodeShared(const Node * node) const {
+            return !snapshots_.empty() && *snapshots_.crbegin() >= node->gen_;
+        }
+
+        // 若 parent->reps_[rep_idx] 指向的 Node 被快照共享, 复制一份并替换, 返回可写的 Node
+        Node * NodeCopyIfShared(Node * parent, size_t rep_idx);
+
+        // 页仍被快照引用时推迟到快照释放
+        void NodeFree(size_t offset);
+
+        void ReleaseSnapshot(uint32_t gen, size_t root_offset);
+#endif
+
         static K_DIFF PackDiffAtAndShift(K_DIFF diff_at, uint8_t shift) {
             return (diff_at << 3) | (7 - shift);
         }
@@ -288,9 +671,59 @@ namespace sgt {
             return {packed_diff >> 3, (~packed_diff) & 0b111 /* 7 - (packed_diff & 0b111) */};
         }
 
+#ifdef SGT_OPTIMISTIC_LOCK
+        // 并发写入下全树共享的计数会成为争用点, 不计数, Iterator 每次移动都核对路径
+        void MarkModified() {}
+#else
+        void MarkModified() { modified_.fetch_add(1, std::memory_order_relaxed); }
+#endif
+
+        // root 至某个 rep 的路径, 每项为 (Node, rep_idx)
+        typedef rocksdb::autovector<std::pair<Node *, size_t /* rep_idx */>, 16> Path;
+
+        void PathLeftmost(Path * que, Node * cursor) const;
+
+        void PathRightmost(Path * que, Node * cursor) const;
+
+        void PathNext(Path * que) const;
+
+        void PathPrev(Path * que) const;
+
+        // 置为首个不小于 target 的 rep 的路径, 不存在时为空
+        template<typename E = std::false_type>
+        void PathSeek(Path * que, const Slice & target, E && expected = {}) const;
+
+        // prefix 指向的 rep 与叶子路径 leaf 的相对位置: -1 整体在前, 0 包含 leaf, 1 整体在后
+        static int PathCompare(const Path & prefix, const Path & leaf);
+
+        // que 末项为 target 下降所至的叶子 reps_[idx + direct], 与 target 不同时纠正为首个不小于 target 的 rep
+        template<typename E = std::false_type>
+        void PathSeekSettle(Path * que, const Slice & target, size_t idx, bool direct, E && expected = {}) const;
+
         template<typename T, bool BACKWARD, typename VISITOR, typename E>
         static void VisitGenericImpl(T self, const Slice & target, VISITOR && visitor, E && expected);
 
+        // 删除 node 内位于 lo、hi 两条路径之间的 rep, 为 nullptr 的一侧不设界
+        // 摘下的 KV 与页分别追加到 transes、pages, 返回删除的个数
+        size_t DeleteRangeImpl(Node * node, const Path * lo, const Path * hi, size_t depth,
+                               std::vector<KV_TRANS> * transes, std::vector<size_t> * pages);
+
+        size_t DeleteRangeDrop(const KV_REP & rep,
+                               std::vector<KV_TRANS> * transes, std::vector<size_t> * pages);
+
+        // 以 prefix 开头的 Key 恰为 node->reps_[lo, hi] 下的全部 Key, 不存在时 node 为 nullptr
+        std::tuple<Node * /* node */, size_t /* lo */, size_t /* hi */>
+        FindPrefix(const Slice & prefix) const;
+
+        template<typename VISITOR>
+        bool VisitSubtree(const KV_REP & rep, VISITOR && visitor) const;
+
+        size_t CountSubtree(const KV_REP & rep) const;
+
+        // BACKWARD 时取前驱, INCLUSIVE 时与 k 相等的 rep 也算在内
+        template<bool BACKWARD, bool INCLUSIVE>
+        KV_REP * Bound(const Slice & k);
+
     protected:
         inline KV_REP Pack(size_t offset) const {
             if constexpr (has_pack<KV_TRANS>::value) {
@@ -326,13 +759,16 @@ namespace sgt {
 
     public:
         enum {
+            kPageSize = NODE_POLICY::kPageSize,
             kNodeRank = NodeRank<>::value,
             kNodeRepRank = kNodeRank + 1,
             kForward = false,
             kBackward = true,
             kMajorVersion = 1,
             kMinorVersion = 20,
-            kMaxKeyLength = std::numeric_limits<K_DIFF>::max() >> 3
+            kMaxKeyLength = std::numeric_limits<K_DIFF>::max() >> 3,
+            kMaxMultiGetWidth = 64,
+            kEstimateExpandNodes = 16
         };
 
         static_assert(PyramidHeight(kNodeRank) == CalcPyramidHeight(kNodeRank));
@@ -16,16 +16,51 @@ namespace sgt {
     template<typename T>
     inline const T * SmartMinElem8(const T * from, const T * to, T * min_val);
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
-    SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
     SignatureTreeTpl(Helper * helper, Allocator * allocator)
             : SignatureTreeTpl(helper, allocator, allocator->AllocatePage()) {
         new(OffsetToMemNode(kRootOffset)) Node();
     }
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
-    bool SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    bool SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
     Get(const Slice & k, std::string * v) const {
+#ifdef SGT_OPTIMISTIC_LOCK
+        EpochManager::Guard guard(&epoch_);
+        restart:
+        const Node * cursor = OffsetToMemNode(kRootOffset);
+        uint32_t version;
+        if (!NodeReadLock(cursor, &version)) {
+            goto restart;
+        }
+        if (SGT_UNLIKELY(NodeSize(cursor) == 0)) {
+            if (!NodeValidate(cursor, version)) {
+                goto restart;
+            }
+            return false;
+        }
+
+        while (true) {
+            auto[idx, direct, _] = FindBestMatch(cursor, k);
+            if (SGT_UNLIKELY(idx + direct >= kNodeRepRank)) { // 读到写者的中间状态
+                goto restart;
+            }
+            const KV_REP rep = cursor->reps_[idx + direct];
+            if (!NodeValidate(cursor, version)) {
+                goto restart;
+            }
+            if (IsPacked(rep)) {
+                cursor = OffsetToMemNode(Unpack(rep));
+                if (!NodeReadLock(cursor, &version)) {
+                    goto restart;
+                }
+            } else {
+                const auto & trans = helper_->Trans(rep);
+                return trans.Get(k, v);
+            }
+        }
+#else
         const Node * cursor = OffsetToMemNode(kRootOffset);
         if (SGT_UNLIKELY(NodeSize(cursor) == 0)) {
             return false;
@@ -41,15 +76,31 @@ namespace sgt {
                 return trans.Get(k, v);
             }
         }
+#endif
     }
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
     template<typename CALLBACK>
-    auto SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
+    auto SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
     GetWithCallback(const Slice & k,
                     CALLBACK && callback) {
+#ifdef SGT_OPTIMISTIC_LOCK
+        // 返回的 KV_REP * 指向 Node 内部, 并发写入后可能失效
+        EpochManager::Guard guard(&epoch_);
+        restart:
+        Node * cursor = OffsetToMemNode(kRootOffset);
+        uint32_t version;
+        if (!NodeReadLock(cursor, &version)) {
+            goto restart;
+        }
+        if (SGT_UNLIKELY(NodeSize(cursor) == 0)) {
+            if (!NodeValidate(cursor, version)) {
+                goto restart;
+            }
+#else
         Node * cursor = OffsetToMemNode(kRootOffset);
         if (SGT_UNLIKELY(NodeSize(cursor) == 0)) {
+#endif
             if constexpr (std::is_same<CALLBACK, std::false_type>::value) {
                 return static_cast<KV_REP *>(nullptr);
             } else {
@@ -59,10 +110,27 @@ namespace sgt {
 
         while (true) {
             auto[idx, direct, _] = FindBestMatch(cursor, k);
+#ifdef SGT_OPTIMISTIC_LOCK
+            if (SGT_UNLIKELY(idx + direct >= kNodeRepRank)) {
+                goto restart;
+            }
+            auto & r = cursor->reps_[idx + direct];
+            const KV_REP copy = r;
+            if (!NodeValidate(cursor, version)) {
+                goto restart;
+            }
+            if (IsPacked(copy)) {
+                cursor = OffsetToMemNode(Unpack(copy));
+                if (!NodeReadLock(cursor, &version)) {
+                    goto restart;
+                }
+            } else {
+#else
             auto & r = cursor->reps_[idx + direct];
             if (IsPacked(r)) {
                 cursor = OffsetToMemNode(Unpack(r));
             } else {
+#endif
                 if constexpr (std::is_same<CALLBACK, std::false_type>::value) {
                     return &r;
                 } else {
@@ -72,9 +140,13 @@ namespace sgt {
         }
     }
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
-    size_t SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    size_t SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
     Size() const {
+#ifdef SGT_SUBTREE_COUNT
+        const Node * root = OffsetToMemNode(kRootOffset);
+        return NodeCount(root, 0, NodeSize(root));
+#else
         auto SizeSub = [this](size_t offset, auto && SizeSub) -> size_t {
             size_t cnt = 0;
             const Node * cursor = OffsetToMemNode(offset);
@@ -89,14 +161,87 @@ namespace sgt {
             return cnt;
         };
         return SizeSub(kRootOffset, SizeSub);
+#endif
     }
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
     template<typename V, typename IF_DUP_CALLBACK>
-    bool SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
+    bool SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
     Add(const Slice & k, V && v,
         IF_DUP_CALLBACK && if_dup_callback) {
         assert(k.size() < kMaxKeyLength);
+        MarkModified();
+#ifdef SGT_OPTIMISTIC_LOCK
+        EpochManager::Guard guard(&epoch_);
+        // 重启时复用已生成的 KV_REP, 保证 helper_->Add 只调用一次
+        KV_REP added{};
+        bool is_added = false;
+        auto make_rep = [&]() -> KV_REP {
+            if constexpr (std::is_convertible<V, KV_REP>::value) {
+                return v;
+            } else {
+                if (!is_added) {
+                    added = helper_->Add(k, std::forward<V>(v));
+                    is_added = true;
+                }
+                return added;
+            }
+        };
+
+        restart:
+        Node * cursor = OffsetToMemNode(kRootOffset);
+        uint32_t version;
+        if (!NodeReadLock(cursor, &version)) {
+            goto restart;
+        }
+        if (SGT_UNLIKELY(NodeSize(cursor) == 0)) {
+            if (!NodeUpgradeLock(cursor, version)) {
+                goto restart;
+            }
+            cursor->reps_[0] = make_rep();
+            cursor->size_ = 1;
+            NodeUnlock(cursor);
+            return true;
+        }
+
+        while (true) {
+            auto[idx, direct, _] = FindBestMatch(cursor, k);
+            if (SGT_UNLIKELY(idx + direct >= kNodeRepRank)) {
+                goto restart;
+            }
+            const KV_REP rep = cursor->reps_[idx + direct];
+            if (!NodeValidate(cursor, version)) {
+                goto restart;
+            }
+            if (IsPacked(rep)) {
+                cursor = OffsetToMemNode(Unpack(rep));
+                if (!NodeReadLock(cursor, &version)) {
+                    goto restart;
+                }
+            } else {
+                auto && trans = helper_->Trans(rep);
+                if (trans == k) {
+                    bool ret = false; // cannot overwrite by default
+                    if constexpr (!std::is_same<IF_DUP_CALLBACK, std::false_type>::value) {
+                        if (!NodeUpgradeLock(cursor, version)) {
+                            goto restart;
+                        }
+                        ret = if_dup_callback(trans, cursor->reps_[idx + direct]);
+                        NodeUnlock(cursor);
+                    }
+                    if (is_added) { // 重启期间他人插入了相同的 Key
+                        auto && added_trans = helper_->Trans(added);
+                        helper_->Del(added_trans);
+                    }
+                    return ret;
+                } else if (CombatInsert(trans.Key(), k, make_rep(),
+                                        cursor, idx, direct, version)) {
+                    return true;
+                }
+                goto restart;
+            }
+        }
+#else
         Node * cursor = OffsetToMemNode(kRootOffset);
         if (SGT_UNLIKELY(NodeSize(cursor) == 0)) {
             if constexpr (std::is_convertible<V, KV_REP>::value) {
@@ -104,6 +249,9 @@ namespace sgt {
             } else {
                 cursor->reps_[0] = helper_->Add(k, std::forward<V>(v));
             }
+#ifdef SGT_SUBTREE_COUNT
+            cursor->counts_[0] = 1;
+#endif
             cursor->size_ = 1;
             return true;
         }
@@ -112,7 +260,11 @@ namespace sgt {
             auto[idx, direct, _] = FindBestMatch(cursor, k);
             auto & rep = cursor->reps_[idx + direct];
             if (IsPacked(rep)) {
+#ifdef SGT_COPY_ON_WRITE
+                cursor = NodeCopyIfShared(cursor, idx + direct);
+#else
                 cursor = OffsetToMemNode(Unpack(rep));
+#endif
             } else {
                 auto && trans = helper_->Trans(rep);
                 if (trans == k) {
@@ -123,20 +275,104 @@ namespace sgt {
                     }
                 } else { // insert
                     if constexpr (std::is_convertible<V, KV_REP>::value) {
-                        return CombatInsert(trans.Key(), k, v,
-                                            cursor, idx, direct);
+                        CombatInsert(trans.Key(), k, v,
+                                     cursor, idx, direct, 0);
                     } else {
-                        return CombatInsert(trans.Key(), k, helper_->Add(k, std::forward<V>(v)),
-                                            cursor, idx, direct);
+                        CombatInsert(trans.Key(), k, helper_->Add(k, std::forward<V>(v)),
+                                     cursor, idx, direct, 0);
                     }
+#ifdef SGT_SUBTREE_COUNT
+                    CountPathAdd(k);
+#endif
+                    return true;
                 }
             }
         }
+#endif
     }
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
-    bool SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    bool SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
     Del(const Slice & k) {
+        MarkModified();
+#ifdef SGT_OPTIMISTIC_LOCK
+        EpochManager::Guard guard(&epoch_);
+        restart:
+        Node * cursor = OffsetToMemNode(kRootOffset);
+        uint32_t version;
+        if (!NodeReadLock(cursor, &version)) {
+            goto restart;
+        }
+        if (SGT_UNLIKELY(NodeSize(cursor) == 0)) {
+            if (!NodeValidate(cursor, version)) {
+                goto restart;
+            }
+            return false;
+        }
+
+        Node * parent = nullptr;
+        size_t parent_idx{};
+        bool parent_direct{};
+        size_t parent_size{};
+        uint32_t parent_version{};
+
+        while (true) {
+            auto[idx, direct, size] = FindBestMatch(cursor, k);
+            if (SGT_UNLIKELY(idx + direct >= kNodeRepRank)) {
+                goto restart;
+            }
+            const KV_REP rep = cursor->reps_[idx + direct];
+            if (!NodeValidate(cursor, version)) {
+                goto restart;
+            }
+            if (IsPacked(rep)) {
+                parent = cursor;
+                parent_idx = idx;
+                parent_direct = direct;
+                parent_size = size;
+                parent_version = version;
+                cursor = OffsetToMemNode(Unpack(rep));
+                if (!NodeReadLock(cursor, &version)) {
+                    goto restart;
+                }
+            } else {
+                auto && trans = helper_->Trans(rep);
+                if (!(trans == k)) {
+                    return false;
+                }
+
+                // 仅在需要合并时锁定 parent, 自上而下加锁
+                bool merge = parent != nullptr && parent->reps_.size() - parent_size + 1 >= size - 1;
+                if (merge && !NodeUpgradeLock(parent, parent_version)) {
+                    goto restart;
+                }
+                if (!NodeUpgradeLock(cursor, version)) {
+                    if (merge) {
+                        NodeUnlockUnchanged(parent);
+                    }
+                    goto restart;
+                }
+
+                helper_->Del(trans);
+                NodeRemove(cursor, idx, direct, size--);
+                if (merge) {
+                    NodeMerge(parent, parent_idx, parent_direct, parent_size,
+                              cursor, size); // cursor 被标记为退役
+                    NodeUnlock(parent);
+                    return true;
+                } else if (KV_REP r;
+                        size == 1 && (r = cursor->reps_[0], IsPacked(r))) {
+                    assert(parent == nullptr);
+                    Node * child = OffsetToMemNode(Unpack(r));
+                    NodeLock(child);
+                    NodeMerge(cursor, 0, false, 1,
+                              child, NodeSize(child));
+                }
+                NodeUnlock(cursor);
+                return true;
+            }
+        }
+#else
         Node * cursor = OffsetToMemNode(kRootOffset);
         if (SGT_UNLIKELY(NodeSize(cursor) == 0)) {
             return false;
@@ -146,20 +382,35 @@ namespace sgt {
         size_t parent_idx{};
         bool parent_direct{};
         size_t parent_size{};
+#ifdef SGT_SUBTREE_COUNT
+        rocksdb::autovector<uint32_t *, 16> counts; // 路径上各 packed rep 的计数, 命中后减一
+#endif
 
         while (true) {
             auto[idx, direct, size] = FindBestMatch(cursor, k);
             const auto & rep = cursor->reps_[idx + direct];
             if (IsPacked(rep)) {
+#ifdef SGT_SUBTREE_COUNT
+                counts.emplace_back(&cursor->counts_[idx + direct]);
+#endif
                 parent = cursor;
                 parent_idx = idx;
                 parent_direct = direct;
                 parent_size = size;
+#ifdef SGT_COPY_ON_WRITE
+                cursor = NodeCopyIfShared(cursor, idx + direct);
+#else
                 cursor = OffsetToMemNode(Unpack(rep));
+#endif
             } else {
                 auto && trans = helper_->Trans(rep);
                 if (trans == k) {
                     helper_->Del(trans);
+#ifdef SGT_SUBTREE_COUNT
+                    for (uint32_t * cnt:counts) {
+                        --*cnt;
+                    }
+#endif
                     NodeRemove(cursor, idx, direct, size--);
                     if (parent != nullptr && parent->reps_.size() - parent_size + 1 >= size) {
                         NodeMerge(parent, parent_idx, parent_direct, parent_size,
@@ -177,17 +428,37 @@ namespace sgt {
                 }
             }
         }
+#endif
     }
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
-    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
     Compact() {
+        MarkModified();
         NodeCompact(OffsetToMemNode(kRootOffset));
     }
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
+#ifdef SGT_SUBTREE_COUNT
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    CountPathAdd(const Slice & k) {
+        // 插入与其间的 NodeSplit 都不改变上层 rep 下的总数, 故插入后沿新路径补记
+        Node * cursor = OffsetToMemNode(kRootOffset);
+        while (true) {
+            auto[idx, direct, _] = FindBestMatch(cursor, k);
+            const auto & rep = cursor->reps_[idx + direct];
+            if (!IsPacked(rep)) {
+                return;
+            }
+            ++cursor->counts_[idx + direct];
+            cursor = OffsetToMemNode(Unpack(rep));
+        }
+    }
+#endif
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
     std::tuple<size_t, bool, size_t>
-    SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
+    SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
     FindBestMatch(const Node * node, const Slice & k) {
 #ifndef SGT_NO_MM_PREFETCH
         _mm_prefetch(&node->size_, _MM_HINT_T0);
@@ -202,9 +473,9 @@ namespace sgt {
         return FindBestMatchImpl(node, k);
     }
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
     std::tuple<size_t, bool, size_t>
-    SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
+    SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
     FindBestMatchImpl(const Node * node, const Slice & k) {
         size_t size = NodeSize(node);
         if (SGT_UNLIKELY(size <= 1)) {
@@ -243,9 +514,14 @@ namespace sgt {
         }
 
         auto direct = (pos >> 3);
-        auto & entry = const_cast<typename Node::Cache &>(node->cache_)[pos];
+        // 多个读者可能同时填写同一项, 以 relaxed 原子操作整体读写 16 位
+        // 同一 pos 推导出的项内容相同, 无需更强的内存序
+        auto & slot = const_cast<typename Node::Cache &>(node->cache_)[pos].as_uint16;
+        typename Node::CacheEntry entry;
+        entry.as_uint16 = __atomic_load_n(&slot, __ATOMIC_RELAXED);
 #define entry_as_ar entry.as_uint8_array
 #define entry_as_ui entry.as_uint16
+#define entry_store(a, b) __atomic_store_n(&slot, typename Node::CacheEntry{{(a), (b)}}.as_uint16, __ATOMIC_RELAXED)
 
         if (entry_as_ui > 1) {
             const K_DIFF * cb;
@@ -344,7 +620,7 @@ namespace sgt {
                         diff_a = diff_m;
                         diff_b = 1;
                     }
-                    entry_as_ui = typename Node::CacheEntry{{diff_a, diff_b}}.as_uint16;
+                    entry_store(diff_a, diff_b);
                     return {min_it - node->diffs_.cbegin(), direct, size};
                 }
                 min_it = node->diffs_.cbegin() + pyramid.TrimRight(node->diffs_.cbegin(), cbegin, cend, &min_val);
@@ -355,7 +631,7 @@ namespace sgt {
                         diff_a = diff_m;
                         diff_b = 1;
                     }
-                    entry_as_ui = typename Node::CacheEntry{{diff_a, diff_b}}.as_uint16;
+                    entry_store(diff_a, diff_b);
                     return {min_it - node->diffs_.cbegin(), direct, size};
                 }
                 min_it = node->diffs_.cbegin() + pyramid.TrimLeft(node->diffs_.cbegin(), cbegin, cend, &min_val);
@@ -367,7 +643,7 @@ namespace sgt {
                 diff_b = diff_n;
             }
             if (min_val - base_val >= 4) {
-                entry_as_ui = typename Node::CacheEntry{{diff_a, diff_b}}.as_uint16;
+                entry_store(diff_a, diff_b);
                 goto search;
             }
         }
@@ -388,7 +664,7 @@ namespace sgt {
                         diff_a = diff_m;
                         diff_b = 1;
                     }
-                    entry_as_ui = typename Node::CacheEntry{{diff_a, diff_b}}.as_uint16;
+                    entry_store(diff_a, diff_b);
                     return {min_it - node->diffs_.cbegin(), direct, size};
                 }
                 min_it = node->diffs_.cbegin() + pyramid.TrimRight(node->diffs_.cbegin(), cbegin, cend, &min_val);
@@ -400,7 +676,7 @@ namespace sgt {
                         diff_a = diff_m;
                         diff_b = 1;
                     }
-                    entry_as_ui = typename Node::CacheEntry{{diff_a, diff_b}}.as_uint16;
+                    entry_store(diff_a, diff_b);
                     return {min_it - node->diffs_.cbegin(), direct, size};
                 }
                 min_it = node->diffs_.cbegin() + pyramid.TrimLeft(node->diffs_.cbegin(), cbegin, cend, &min_val);
@@ -412,12 +688,13 @@ namespace sgt {
                 diff_b = diff_n;
             }
             if (min_val - base_val >= 4) {
-                entry_as_ui = typename Node::CacheEntry{{diff_a, diff_b}}.as_uint16;
+                entry_store(diff_a, diff_b);
                 goto search;
             }
         }
 #undef entry_as_ar
 #undef entry_as_ui
+#undef entry_store
 #else
         const K_DIFF * cbegin = node->diffs_.cbegin();
         const K_DIFF * cend = &node->diffs_[size - 1];
@@ -426,7 +703,14 @@ namespace sgt {
         auto pyramid = node->pyramid_;
         const K_DIFF * min_it = cbegin + node->pyramid_.MinAt(cbegin, cend, &min_val);
         while (true) {
+#ifdef SGT_OPTIMISTIC_LOCK
+            // 乐观读可能看到写者修改中的 pyramid, 越界即返回非法 idx 促使调用方重试
+            if (SGT_UNLIKELY(min_it < cbegin || min_it >= cend)) {
+                return {kNodeRepRank, false, size};
+            }
+#else
             assert(min_it == std::min_element(cbegin, cend) && *min_it == min_val);
+#endif
             auto[diff_at, shift] = UnpackDiffAtAndShift(min_val);
 
             // left or right?
@@ -451,10 +735,10 @@ namespace sgt {
 #endif
     }
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
-    bool SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    bool SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
     CombatInsert(const Slice & opponent, const Slice & k, KV_REP v,
-                 Node * hint, size_t hint_idx, bool hint_direct) {
+                 Node * hint, size_t hint_idx, bool hint_direct, [[maybe_unused]] uint32_t hint_version) {
         K_DIFF diff_at = 0;
         char a, b;
         while ((a = opponent[diff_at]) == (b = k[diff_at])) {
@@ -468,12 +752,25 @@ namespace sgt {
 
         K_DIFF packed_diff = PackDiffAtAndShift(diff_at, shift);
         Node * cursor = hint;
+#ifdef SGT_OPTIMISTIC_LOCK
+        // 返回 false 表示读到过期版本, 需由 Add 从头重试
+        uint32_t version = hint_version;
+#endif
         restart:
         while (true) {
             size_t insert_idx;
             bool insert_direct;
 
             size_t cursor_size = NodeSize(cursor);
+#ifdef SGT_OPTIMISTIC_LOCK
+            if (SGT_UNLIKELY(cursor_size == 0)) { // 已被并发清空
+                return false;
+            }
+            if (cursor_size == 1) { // hint 可能不是当前的 root
+                hint_idx = 0;
+                hint_direct = false;
+            }
+#endif
             if (cursor_size == 1 || (hint != nullptr && packed_diff > hint->diffs_[hint_idx])) {
                 insert_idx = hint_idx;
                 insert_direct = hint_direct;
@@ -486,11 +783,22 @@ namespace sgt {
                 auto pyramid = cursor->pyramid_;
                 const K_DIFF * min_it = cbegin + cursor->pyramid_.MinAt(cbegin, cend, &exist_diff);
                 while (true) {
+#ifdef SGT_OPTIMISTIC_LOCK
+                    if (SGT_UNLIKELY(min_it < cbegin || min_it >= cend)) {
+                        return false;
+                    }
+#else
                     assert(min_it == std::min_element(cbegin, cend) && *min_it == exist_diff);
+#endif
                     if (exist_diff > packed_diff) {
                         if (hint != nullptr) {
                             hint = nullptr;
                             cursor = OffsetToMemNode(kRootOffset);
+#ifdef SGT_OPTIMISTIC_LOCK
+                            if (!NodeReadLock(cursor, &version)) {
+                                return false;
+                            }
+#endif
                             goto restart;
                         }
                         insert_idx = (!direct ? cbegin : (cend - 1)) - cursor->diffs_.cbegin();
@@ -526,6 +834,43 @@ namespace sgt {
                 }
             }
 
+#ifdef SGT_OPTIMISTIC_LOCK
+            if (SGT_UNLIKELY(insert_idx + insert_direct >= kNodeRepRank)) {
+                return false;
+            }
+            const KV_REP rep = cursor->reps_[insert_idx + insert_direct];
+            if (cursor->diffs_[insert_idx] > packed_diff || !IsPacked(rep)) {
+                if (!NodeUpgradeLock(cursor, version)) {
+                    return false;
+                }
+                if (IsNodeFull(cursor)) {
+                    try {
+                        NodeSplit(cursor);
+                    } catch (const AllocatorFullException &) {
+                        NodeUnlockUnchanged(cursor);
+                        allocator_->Grow();
+                        assert(allocator_->Base() == base_);
+                        return false;
+                    }
+                    NodeUnlock(cursor);
+                    if (!NodeReadLock(cursor, &version)) {
+                        return false;
+                    }
+                    continue;
+                }
+                NodeInsert(cursor, insert_idx, insert_direct,
+                           direct, packed_diff, v, cursor_size);
+                NodeUnlock(cursor);
+                break;
+            }
+            if (!NodeValidate(cursor, version)) {
+                return false;
+            }
+            cursor = OffsetToMemNode(Unpack(rep));
+            if (!NodeReadLock(cursor, &version)) {
+                return false;
+            }
+#else
             const auto & rep = cursor->reps_[insert_idx + insert_direct];
             if (cursor->diffs_[insert_idx] > packed_diff || !IsPacked(rep)) {
                 if (IsNodeFull(cursor)) {
@@ -545,7 +890,12 @@ namespace sgt {
                            direct, packed_diff, v, cursor_size);
                 break;
             }
+#ifdef SGT_COPY_ON_WRITE
+            cursor = NodeCopyIfShared(cursor, insert_idx + insert_direct);
+#else
             cursor = OffsetToMemNode(Unpack(rep));
+#endif
+#endif
         }
         return true;
     }
@@ -590,13 +940,16 @@ do { \
     memcpy(&dst[dst_idx__], &src[src_idx__], sizeof(src[0]) * n__); \
 } while (false)
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
-    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
     NodeSplit(Node * parent) {
         for (size_t i = 0; i < parent->reps_.size(); ++i) {
             const auto & rep = parent->reps_[i];
             if (IsPacked(rep)) {
                 Node * child = OffsetToMemNode(Unpack(rep));
+#ifdef SGT_OPTIMISTIC_LOCK
+                NodeLock(child);
+#endif
                 if (!IsNodeFull(child)) {
                     size_t child_size = NodeSize(child);
 
@@ -615,11 +968,19 @@ do { \
                         // enough space?
                         size_t range = j - i;
                         if (child_size + range <= child->reps_.size()) { // move to the tail
+#ifdef SGT_COPY_ON_WRITE
+                            child = NodeCopyIfShared(parent, i);
+#endif
                             size_t child_diff_size = child_size - 1;
                             j = i + 1;
 
                             cpy_part(child->diffs_, child_diff_size, parent->diffs_, i, range);
                             cpy_part(child->reps_, child_size, parent->reps_, j, range);
+#ifdef SGT_SUBTREE_COUNT
+                            cpy_part(child->counts_, child_size, parent->counts_, j, range);
+                            parent->counts_[i] += NodeCount(parent, j, j + range);
+                            del_gaps(parent->counts_, j, parent->counts_.size(), range);
+#endif
 
                             del_gaps(parent->diffs_, i, parent->diffs_.size(), range);
                             del_gaps(parent->reps_, j, parent->reps_.size(), range);
@@ -629,7 +990,10 @@ do { \
                             assert(NodeSize(parent) == parent->reps_.size() - range);
                             assert(NodeSize(child) == child_size + range);
                             NodeBuild(parent, i);
-                            NodeBuild(child, child_diff_size);
+                            NodeBuildGrown(child, child_size, child_diff_size);
+#ifdef SGT_OPTIMISTIC_LOCK
+                            NodeUnlock(child);
+#endif
                             return;
                         }
                     } else { // right
@@ -644,11 +1008,20 @@ do { \
 
                         size_t range = i - j;
                         if (child_size + range <= child->reps_.size()) { // move to the head
+#ifdef SGT_COPY_ON_WRITE
+                            child = NodeCopyIfShared(parent, i);
+#endif
                             add_gaps(child->diffs_, 0, child_size - 1, range);
                             add_gaps(child->reps_, 0, child_size, range);
 
                             cpy_part(child->diffs_, 0, parent->diffs_, j, range);
                             cpy_part(child->reps_, 0, parent->reps_, j, range);
+#ifdef SGT_SUBTREE_COUNT
+                            add_gaps(child->counts_, 0, child_size, range);
+                            cpy_part(child->counts_, 0, parent->counts_, j, range);
+                            parent->counts_[i] += NodeCount(parent, j, i);
+                            del_gaps(parent->counts_, j, parent->counts_.size(), range);
+#endif
 
                             del_gaps(parent->diffs_, j, parent->diffs_.size(), range);
                             del_gaps(parent->reps_, j, parent->reps_.size(), range);
@@ -659,15 +1032,24 @@ do { \
                             assert(NodeSize(child) == child_size + range);
                             NodeBuild(parent, j);
                             NodeBuild(child);
+#ifdef SGT_OPTIMISTIC_LOCK
+                            NodeUnlock(child);
+#endif
                             return;
                         }
                     }
                 }
+#ifdef SGT_OPTIMISTIC_LOCK
+                NodeUnlockUnchanged(child);
+#endif
             }
         }
 
         size_t offset = allocator_->AllocatePage(); // may throw AllocatorFullException
         Node * child = new(OffsetToMemNode(offset)) Node();
+#ifdef SGT_COPY_ON_WRITE
+        child->gen_ = CurrentGen();
+#endif
 
         // find nearly half
         const K_DIFF * cbegin = parent->diffs_.cbegin();
@@ -704,6 +1086,11 @@ do { \
         del_gaps(parent->diffs_, nth, parent->diffs_.size(), item_num);
         del_gaps(parent->reps_, nth + 1, parent->reps_.size(), item_num);
         parent->reps_[nth] = Pack(offset);
+#ifdef SGT_SUBTREE_COUNT
+        cpy_part(child->counts_, 0, parent->counts_, nth, child_size);
+        del_gaps(parent->counts_, nth + 1, parent->counts_.size(), item_num);
+        parent->counts_[nth] = NodeCount(child, 0, child_size);
+#endif
 
         child->size_ = static_cast<uint32_t>(child_size);
         parent->size_ -= item_num;
@@ -711,8 +1098,8 @@ do { \
         NodeBuild(child);
     }
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
-    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
     NodeMerge(Node * parent, size_t idx, bool direct, size_t parent_size,
               Node * child, size_t child_size) {
         idx += static_cast<size_t>(direct);
@@ -724,20 +1111,35 @@ do { \
 
         cpy_part(parent->diffs_, idx, child->diffs_, 0, child_diff_size);
         cpy_part(parent->reps_, idx, child->reps_, 0, child_size);
+#ifdef SGT_SUBTREE_COUNT
+        add_gaps(parent->counts_, idx + 1, parent_size, child_diff_size);
+        cpy_part(parent->counts_, idx, child->counts_, 0, child_size);
+#endif
 
+#ifdef SGT_OPTIMISTIC_LOCK
+        NodeUnlockObsolete(child);
+        RetirePage(offset);
+#elif defined(SGT_COPY_ON_WRITE)
+        NodeFree(offset);
+#else
         allocator_->FreePage(offset);
+#endif
         parent->size_ += child_diff_size;
-        NodeBuild(parent, idx);
+        NodeBuildGrown(parent, parent_size, idx);
     }
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
-    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
     NodeCompact(Node * node) {
         for (size_t i = 0; !IsNodeFull(node) && i < NodeSize(node); ++i) {
             restart:
             const auto & rep = node->reps_[i];
             if (IsPacked(rep)) {
+#ifdef SGT_COPY_ON_WRITE
+                Node * child = NodeCopyIfShared(node, i);
+#else
                 Node * child = OffsetToMemNode(Unpack(rep));
+#endif
                 size_t child_size = NodeSize(child);
                 size_t node_size = NodeSize(node);
 
@@ -761,13 +1163,19 @@ do { \
 
                         cpy_part(node->diffs_, i, child->diffs_, 0, item_num);
                         cpy_part(node->reps_, i, child->reps_, 0, item_num);
+#ifdef SGT_SUBTREE_COUNT
+                        add_gaps(node->counts_, i, node_size, item_num);
+                        cpy_part(node->counts_, i, child->counts_, 0, item_num);
+                        node->counts_[i + item_num] -= NodeCount(child, 0, item_num);
+                        del_gaps(child->counts_, 0, child_size, item_num);
+#endif
 
                         del_gaps(child->diffs_, 0, child_size - 1, item_num);
                         del_gaps(child->reps_, 0, child_size, item_num);
 
                         node->size_ += item_num;
                         child->size_ -= item_num;
-                        NodeBuild(node, i);
+                        NodeBuildGrown(node, node_size, i);
                         NodeBuild(child);
                         goto restart;
                     }
@@ -783,10 +1191,15 @@ do { \
 
                         cpy_part(node->diffs_, i, child->diffs_, nth, item_num);
                         cpy_part(node->reps_, j, child->reps_, nth + 1, item_num);
+#ifdef SGT_SUBTREE_COUNT
+                        add_gaps(node->counts_, j, node_size, item_num);
+                        cpy_part(node->counts_, j, child->counts_, nth + 1, item_num);
+                        node->counts_[i] -= NodeCount(child, nth + 1, nth + 1 + item_num);
+#endif
 
                         node->size_ += item_num;
                         child->size_ -= item_num;
-                        NodeBuild(node, i);
+                        NodeBuildGrown(node, node_size, i);
                         NodeBuild(child, nth);
                         goto restart;
                     }
@@ -797,13 +1210,17 @@ do { \
         for (size_t i = 0; i < NodeSize(node); ++i) {
             const auto & rep = node->reps_[i];
             if (IsPacked(rep)) {
+#ifdef SGT_COPY_ON_WRITE
+                NodeCompact(NodeCopyIfShared(node, i));
+#else
                 NodeCompact(OffsetToMemNode(Unpack(rep)));
+#endif
             }
         }
     }
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
-    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
     NodeInsert(Node * node, size_t insert_idx, bool insert_direct,
                bool direct, K_DIFF diff, const KV_REP & rep, size_t size) {
         assert(!IsNodeFull(node));
@@ -815,15 +1232,22 @@ do { \
 
         node->diffs_[insert_idx] = diff;
         node->reps_[rep_idx] = rep;
+#ifdef SGT_SUBTREE_COUNT
+        add_gap(node->counts_, rep_idx, size);
+        node->counts_[rep_idx] = 1;
+#endif
         node->size_ = size + 1;
         NodeBuild(node, insert_idx);
     }
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
-    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
     NodeRemove(Node * node, size_t idx, bool direct, size_t size) {
         assert(size >= 1);
         del_gap(node->reps_, idx + direct, size);
+#ifdef SGT_SUBTREE_COUNT
+        del_gap(node->counts_, idx + direct, size);
+#endif
         node->size_ = --size;
         if (SGT_LIKELY(size > 0)) {
             del_gap(node->diffs_, idx, size);
@@ -831,8 +1255,30 @@ do { \
         }
     }
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
-    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    NodeRemoveRange(Node * node, size_t from, size_t to) {
+        size_t size = NodeSize(node);
+        assert(from < to && to <= size);
+        size_t n = to - from;
+        if (from != 0 && to != size) {
+            node->diffs_[from - 1] = *std::min_element(&node->diffs_[from - 1], &node->diffs_[to]);
+            del_gaps(node->diffs_, from, size - 1, n);
+        } else if (from == 0 && to != size) {
+            del_gaps(node->diffs_, 0, size - 1, n);
+        }
+        del_gaps(node->reps_, from, size, n);
+#ifdef SGT_SUBTREE_COUNT
+        del_gaps(node->counts_, from, size, n);
+#endif
+        node->size_ = static_cast<uint32_t>(size - n);
+        if (SGT_LIKELY(size != n)) {
+            NodeBuild(node, from != 0 ? from - 1 : 0);
+        }
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
     NodeBuild(Node * node, size_t rebuild_idx) {
 #ifndef SGT_NO_DENSE_INPUT_CACHE
         node->cache_ = {};
@@ -840,6 +1286,12 @@ do { \
         node->pyramid_.Build(node->diffs_.data(), node->diffs_.data() + NodeSize(node) - 1, rebuild_idx);
     }
 
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    NodeBuildGrown(Node * node, size_t old_size, size_t rebuild_idx) {
+        NodeBuild(node, old_size > kPyramidBrickLength + 1 ? rebuild_idx : 0);
+    }
+
 #undef add_gap
 #undef del_gap
 #undef add_gaps
@@ -0,0 +1,265 @@
+#pragma once
+#ifndef SIG_TREE_SIG_TREE_ITERATOR_IMPL_H
+#define SIG_TREE_SIG_TREE_ITERATOR_IMPL_H
+
+#ifndef SGT_NO_MM_PREFETCH
+#include <xmmintrin.h>
+#endif
+
+#include <algorithm>
+#include <vector>
+
+#include "likely.h"
+#include "sig_tree.h"
+#include "sig_tree_visit_impl.h"
+
+namespace sgt {
+    /*
+     * 持有 root 至当前 rep 的路径, 扫描可随时暂停、交错, 或跨调用保存
+     * 树被修改后, 下一次移动先自顶向下核对路径: 只读取仍被上层引用的 Node, 仍能走到原 rep 则直接沿用
+     * SGT_OPTIMISTIC_LOCK 下树不记录修改, 每次移动都核对
+     * 否则以原 rep 为 expected 重新 Seek, 找回原 rep 时免去 KV 比较
+     * 重新 Seek 需读取原 rep 的 Key, 故其 KV 即便已被删除, 也须在迭代器下一次移动前仍可读取
+     *
+     * 与 Visit 相同, 移动时须独占访问
+     */
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    class SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::Iterator {
+        friend class SignatureTreeTpl; // MultiSeek 直接填充 path_
+
+    private:
+        const SignatureTreeTpl * tree_;
+        Path path_;
+        KV_REP rep_{};
+#ifndef SGT_OPTIMISTIC_LOCK
+        uint64_t modified_;
+#endif
+
+    public:
+        explicit Iterator(const SignatureTreeTpl * tree)
+                : tree_(tree)
+#ifndef SGT_OPTIMISTIC_LOCK
+                , modified_(tree->modified_.load(std::memory_order_relaxed))
+#endif
+        {}
+
+    public:
+        bool Valid() const { return !path_.empty(); }
+
+        // 最近一次移动到达的 rep, 之后树被修改也不变
+        const KV_REP & Rep() const {
+            assert(Valid());
+            return rep_;
+        }
+
+        void SeekToFirst() {
+            path_.clear();
+            Node * root = tree_->OffsetToMemNode(tree_->kRootOffset);
+            if (NodeSize(root) != 0) {
+                tree_->PathLeftmost(&path_, root);
+            }
+            Settle();
+        }
+
+        void SeekToLast() {
+            path_.clear();
+            Node * root = tree_->OffsetToMemNode(tree_->kRootOffset);
+            if (NodeSize(root) != 0) {
+                tree_->PathRightmost(&path_, root);
+            }
+            Settle();
+        }
+
+        // 首个不小于 target 的 rep, target 为空时同 SeekToFirst
+        void Seek(const Slice & target) {
+            if (target.size() == 0) {
+                SeekToFirst();
+                return;
+            }
+            path_.clear();
+            tree_->PathSeek(&path_, target);
+            Settle();
+        }
+
+        // 最后一个不大于 target 的 rep
+        void SeekForPrev(const Slice & target) {
+            Seek(target);
+            if (!Valid()) {
+                SeekToLast();
+            } else if (!(tree_->helper_->Trans(rep_) == target)) {
+                tree_->PathPrev(&path_);
+                Settle();
+            }
+        }
+
+        void Next() {
+            assert(Valid());
+            if (Revalidate()) {
+                tree_->PathNext(&path_);
+            }
+            Settle();
+        }
+
+        void Prev() {
+            assert(Valid());
+            Revalidate();
+            if (!Valid()) { // 原 rep 之后已无 rep
+                SeekToLast();
+                return;
+            }
+            tree_->PathPrev(&path_);
+            Settle();
+        }
+
+    private:
+        void Settle() {
+            if (Valid()) {
+                auto[node, rep_idx] = path_.back();
+                rep_ = node->reps_[rep_idx];
+            }
+#ifndef SGT_OPTIMISTIC_LOCK
+            modified_ = tree_->modified_.load(std::memory_order_relaxed);
+#endif
+        }
+
+        // 返回 true 表示 path_ 指向原 rep 或与其相同的 Key, 否则指向其后继 (可能为空)
+        bool Revalidate() {
+#ifndef SGT_OPTIMISTIC_LOCK
+            if (SGT_LIKELY(tree_->modified_.load(std::memory_order_relaxed) == modified_)) {
+                return true;
+            }
+#endif
+
+            Node * cursor = tree_->OffsetToMemNode(tree_->kRootOffset);
+            for (size_t i = 0; i < path_.size(); ++i) {
+                auto[node, rep_idx] = path_[i];
+                if (node != cursor || rep_idx >= NodeSize(node)) {
+                    break;
+                }
+                const KV_REP & rep = node->reps_[rep_idx];
+                if (i + 1 == path_.size()) {
+                    if (rep == rep_) {
+                        return true;
+                    }
+                } else if (tree_->IsPacked(rep)) {
+                    cursor = tree_->OffsetToMemNode(tree_->Unpack(rep));
+                } else {
+                    break;
+                }
+            }
+
+            path_.clear();
+            auto && trans = tree_->helper_->Trans(rep_);
+            const Slice & k = trans.Key();
+            tree_->PathSeek(&path_, k, rep_);
+            if (!Valid()) {
+                return false;
+            }
+            auto[node, rep_idx] = path_.back();
+            const KV_REP & rep = node->reps_[rep_idx];
+            return rep == rep_ || tree_->helper_->Trans(rep) == k;
+        }
+    };
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    template<typename CALLBACK>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    MultiSeek(const Slice * ks, size_t n, CALLBACK && callback, size_t width) const {
+        Node * root = OffsetToMemNode(kRootOffset);
+        if (SGT_UNLIKELY(NodeSize(root) == 0)) {
+            Iterator iter(this);
+            for (size_t i = 0; i < n; ++i) {
+                iter.Settle();
+                callback(i, iter);
+            }
+            return;
+        }
+
+        // 每个槽位轮流推进一步: 在 Node 内定位 rep 并预取; 读取 rep, 下降并预取子 Node;
+        // 到达叶子后 (可选地) 预取 KV; 最后比较 Key, 必要时纠正路径
+        struct Lane {
+            Iterator iter;
+            Node * node;
+            const KV_REP * rep;
+            size_t idx;
+            bool direct;
+            bool fetched;
+            size_t i;
+        };
+        width = std::clamp(width, static_cast<size_t>(1), static_cast<size_t>(kMaxMultiGetWidth));
+        std::vector<Lane> lanes;
+        lanes.reserve(std::min(width, n));
+        auto start = [root](Lane * lane, size_t i) {
+            lane->iter.path_.clear();
+            lane->node = root;
+            lane->rep = nullptr;
+            lane->fetched = false;
+            lane->i = i;
+        };
+
+        size_t pending = 0;
+        while (lanes.size() < width && pending < n) {
+            lanes.push_back({Iterator(this)});
+            start(&lanes.back(), pending++);
+        }
+
+        while (!lanes.empty()) {
+            for (size_t j = 0; j < lanes.size();) {
+                Lane & lane = lanes[j];
+                if (lane.rep == nullptr) {
+                    size_t size;
+                    std::tie(lane.idx, lane.direct, size) = FindBestMatchImpl(lane.node, ks[lane.i]);
+                    size_t rep_idx = lane.idx + lane.direct;
+                    lane.rep = &lane.node->reps_[rep_idx];
+                    lane.iter.path_.emplace_back(lane.node, rep_idx);
+#ifndef SGT_NO_MM_PREFETCH
+                    _mm_prefetch(lane.rep, _MM_HINT_T0);
+#endif
+                    ++j;
+                    continue;
+                }
+
+                const auto & r = *lane.rep;
+                if (IsPacked(r)) {
+                    lane.node = OffsetToMemNode(Unpack(r));
+                    lane.rep = nullptr;
+#ifndef SGT_NO_MM_PREFETCH
+                    _mm_prefetch(&lane.node->size_, _MM_HINT_T0);
+                    auto p = reinterpret_cast<const char *>(&lane.node->diffs_);
+                    p -= reinterpret_cast<uintptr_t>(p) % 64;
+                    _mm_prefetch(p + 64 * 0, _MM_HINT_T2);
+                    _mm_prefetch(p + 64 * 1, _MM_HINT_T2);
+                    _mm_prefetch(p + 64 * 2, _MM_HINT_T2);
+                    _mm_prefetch(p + 64 * 3, _MM_HINT_T2);
+                    _mm_prefetch(p + 64 * 4, _MM_HINT_T2);
+#endif
+                    ++j;
+                    continue;
+                }
+                if constexpr (has_prefetch<KV_TRANS>::value) {
+                    if (!lane.fetched) {
+                        KV_TRANS::Prefetch(r);
+                        lane.fetched = true;
+                        ++j;
+                        continue;
+                    }
+                }
+
+                PathSeekSettle(&lane.iter.path_, ks[lane.i], lane.idx, lane.direct);
+                lane.iter.Settle();
+                callback(lane.i, lane.iter);
+                if (pending < n) {
+                    start(&lane, pending++);
+                    ++j;
+                } else {
+                    if (&lane != &lanes.back()) {
+                        lane = std::move(lanes.back());
+                    }
+                    lanes.pop_back();
+                }
+            }
+        }
+    }
+}
+
+#endif //SIG_TREE_SIG_TREE_ITERATOR_IMPL_H
@@ -0,0 +1,172 @@
+#pragma once
+#ifndef SIG_TREE_SIG_TREE_LOOKUP_IMPL_H
+#define SIG_TREE_SIG_TREE_LOOKUP_IMPL_H
+
+#ifndef SGT_NO_MM_PREFETCH
+#include <xmmintrin.h>
+#endif
+
+#include <deque>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "likely.h"
+#include "sig_tree.h"
+
+namespace sgt {
+    /*
+     * 可挂起的单 Key 查找, 即手写的无栈协程
+     * 每次 Resume 推进一步后返回: 在 Node 内定位 rep 并预取, 或读取 rep 后下降并预取子 Node
+     * 调用方在两次 Resume 之间处理其他查找, 用别处的计算掩盖访存延迟
+     * 可在调用方的协程中 co_await 一次 Resume, 由其调度器交错来自不同请求的查找
+     *
+     * k 须在查找结束前有效, 结果与 GetWithCallback 相同
+     */
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    class SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::Lookup {
+    private:
+        SignatureTreeTpl * tree_;
+        Slice k_;
+        Node * cursor_;
+        KV_REP * rep_ = nullptr;
+        bool done_ = false;
+
+    public:
+        Lookup(SignatureTreeTpl * tree, const Slice & k)
+                : tree_(tree),
+                  k_(k),
+                  cursor_(tree->OffsetToMemNode(tree->kRootOffset)) {
+#ifndef SGT_OPTIMISTIC_LOCK
+            if (SGT_UNLIKELY(NodeSize(cursor_) == 0)) {
+                done_ = true;
+            }
+#endif
+        }
+
+    public:
+        // 返回 true 表示查找已结束
+        bool Resume() {
+            assert(!done_);
+#ifdef SGT_OPTIMISTIC_LOCK
+            // 挂起期间无法持有 epoch 与版本, 一次完成
+            rep_ = tree_->GetWithCallback(k_);
+            done_ = true;
+#else
+            if (rep_ == nullptr) {
+                auto[idx, direct, _] = FindBestMatchImpl(cursor_, k_);
+                rep_ = &cursor_->reps_[idx + direct];
+#ifndef SGT_NO_MM_PREFETCH
+                _mm_prefetch(rep_, _MM_HINT_T0);
+#endif
+                return false;
+            }
+
+            const auto & r = *rep_;
+            if (!tree_->IsPacked(r)) {
+                done_ = true;
+                return true;
+            }
+            cursor_ = tree_->OffsetToMemNode(tree_->Unpack(r));
+            rep_ = nullptr;
+#ifndef SGT_NO_MM_PREFETCH
+            _mm_prefetch(&cursor_->size_, _MM_HINT_T0);
+            auto p = reinterpret_cast<const char *>(&cursor_->diffs_);
+            p -= reinterpret_cast<uintptr_t>(p) % 64;
+            _mm_prefetch(p + 64 * 0, _MM_HINT_T2);
+            _mm_prefetch(p + 64 * 1, _MM_HINT_T2);
+            _mm_prefetch(p + 64 * 2, _MM_HINT_T2);
+            _mm_prefetch(p + 64 * 3, _MM_HINT_T2);
+            _mm_prefetch(p + 64 * 4, _MM_HINT_T2);
+#endif
+#endif
+            return done_;
+        }
+
+        bool Done() const { return done_; }
+
+        // 查找结束后有效, 空树返回 nullptr
+        KV_REP * Result() const {
+            assert(done_);
+            return rep_;
+        }
+    };
+
+    /*
+     * 轮转推进至多 width 个 Lookup, 结束的槽位立即换入等待中的查找
+     * 不同来源的查找可随时 Submit, 无须凑成固定的批
+     */
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    class SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::LookupScheduler {
+    public:
+        typedef std::function<void(KV_REP * rep)> Callback;
+
+    private:
+        SignatureTreeTpl * const tree_;
+        const size_t width_;
+        std::vector<std::pair<Lookup, Callback>> active_;
+        std::deque<std::pair<Slice, Callback>> pending_;
+
+    public:
+        explicit LookupScheduler(SignatureTreeTpl * tree, size_t width = 16)
+                : tree_(tree),
+                  width_(width != 0 ? width : 1) {
+            active_.reserve(width_);
+        }
+
+    public:
+        // k 须在 callback 被调用前有效
+        void Submit(const Slice & k, Callback callback) {
+            if (active_.size() < width_) {
+                active_.emplace_back(Lookup(tree_, k), std::move(callback));
+            } else {
+                pending_.emplace_back(k, std::move(callback));
+            }
+        }
+
+        // 每个在途的查找推进一步, 返回 false 表示全部结束
+        // callback 中可以 Submit
+        bool Poll() {
+            for (size_t i = 0; i < active_.size();) {
+                auto & slot = active_[i];
+                if (!slot.first.Done() && !slot.first.Resume()) {
+                    ++i;
+                    continue;
+                }
+
+                Callback callback = std::move(slot.second);
+                KV_REP * rep = slot.first.Result();
+                if (Refill(&slot)) {
+                    ++i;
+                } else {
+                    if (&slot != &active_.back()) {
+                        slot = std::move(active_.back());
+                    }
+                    active_.pop_back();
+                }
+                callback(rep);
+            }
+            return !active_.empty();
+        }
+
+        void Run() {
+            while (Poll()) {}
+        }
+
+        size_t Inflight() const { return active_.size() + pending_.size(); }
+
+    private:
+        // 以等待中的查找替换 slot, 无可替换时返回 false
+        bool Refill(std::pair<Lookup, Callback> * slot) {
+            if (pending_.empty()) {
+                return false;
+            }
+            auto & next = pending_.front();
+            *slot = {Lookup(tree_, next.first), std::move(next.second)};
+            pending_.pop_front();
+            return true;
+        }
+    };
+}
+
+#endif //SIG_TREE_SIG_TREE_LOOKUP_IMPL_H
@@ -6,13 +6,18 @@
 #include <xmmintrin.h>
 #endif
 
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <vector>
+
 #include "likely.h"
 #include "sig_tree.h"
 
 namespace sgt {
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
     template<size_t N, typename CALLBACK>
-    auto SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
+    auto SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
     MultiGetWithCallback(const Slice * ks,
                          CALLBACK && callback) {
         std::array<KV_REP *, N> reps{};
@@ -74,6 +79,489 @@ namespace sgt {
             return callback(reps);
         }
     }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    template<typename CALLBACK>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    MultiGet(const Slice * ks, size_t n, CALLBACK && callback, size_t width) {
+#ifdef SGT_OPTIMISTIC_LOCK
+        // 交错的查找无法逐 Node 校验版本, 退化为逐个 GetWithCallback
+        for (size_t i = 0; i < n; ++i) {
+            callback(i, GetWithCallback(ks[i]));
+        }
+#else
+        if (SGT_UNLIKELY(NodeSize(OffsetToMemNode(kRootOffset)) == 0)) {
+            for (size_t i = 0; i < n; ++i) {
+                callback(i, static_cast<KV_REP *>(nullptr));
+            }
+            return;
+        }
+        MultiFindBestMatch(ks, n, [&callback](size_t i, const Match & match) {
+            callback(i, &match.node->reps_[match.idx + match.direct]);
+        }, width);
+#endif
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    template<typename CALLBACK>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    MultiFindBestMatch(const Slice * ks, size_t n, CALLBACK && callback, size_t width) {
+        Node * root = OffsetToMemNode(kRootOffset);
+        assert(NodeSize(root) != 0);
+
+        // 每个槽位交替两步: 在 Node 内定位 rep 并预取; 读取 rep, 下降并预取子 Node
+        struct Lane {
+            Match match;
+            const KV_REP * rep;
+            size_t i;
+        };
+        std::array<Lane, kMaxMultiGetWidth> lanes;
+        width = std::clamp(width, static_cast<size_t>(1), static_cast<size_t>(kMaxMultiGetWidth));
+        auto start = [root](Lane * lane, size_t i) {
+            lane->match.node = root;
+            lane->match.parent = nullptr;
+            lane->match.depth = 0;
+            lane->rep = nullptr;
+            lane->i = i;
+        };
+
+        size_t pending = 0;
+        size_t active = 0;
+        while (active < width && pending < n) {
+            start(&lanes[active++], pending++);
+        }
+
+        while (active != 0) {
+            for (size_t j = 0; j < active;) {
+                Lane & lane = lanes[j];
+                Match & match = lane.match;
+                if (lane.rep == nullptr) {
+                    std::tie(match.idx, match.direct, match.size) = FindBestMatchImpl(match.node, ks[lane.i]);
+                    lane.rep = &match.node->reps_[match.idx + match.direct];
+#ifndef SGT_NO_MM_PREFETCH
+                    _mm_prefetch(lane.rep, _MM_HINT_T0);
+#endif
+                    ++j;
+                    continue;
+                }
+
+                const auto & r = *lane.rep;
+                if (IsPacked(r)) {
+                    match.parent = match.node;
+                    match.parent_idx = match.idx;
+                    match.parent_direct = match.direct;
+                    match.parent_size = match.size;
+                    match.node = OffsetToMemNode(Unpack(r));
+                    ++match.depth;
+                    lane.rep = nullptr;
+#ifndef SGT_NO_MM_PREFETCH
+                    _mm_prefetch(&match.node->size_, _MM_HINT_T0);
+                    auto p = reinterpret_cast<const char *>(&match.node->diffs_);
+                    p -= reinterpret_cast<uintptr_t>(p) % 64;
+                    _mm_prefetch(p + 64 * 0, _MM_HINT_T2);
+                    _mm_prefetch(p + 64 * 1, _MM_HINT_T2);
+                    _mm_prefetch(p + 64 * 2, _MM_HINT_T2);
+                    _mm_prefetch(p + 64 * 3, _MM_HINT_T2);
+                    _mm_prefetch(p + 64 * 4, _MM_HINT_T2);
+#endif
+                    ++j;
+                    continue;
+                }
+
+                callback(lane.i, match);
+                if (pending < n) {
+                    start(&lane, pending++);
+                    ++j;
+                } else {
+                    lane = lanes[--active];
+                }
+            }
+        }
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    template<typename CALLBACK>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    SortedFindBestMatch(const Slice * ks, size_t n, CALLBACK && callback) {
+        Node * root = OffsetToMemNode(kRootOffset);
+        assert(NodeSize(root) != 0);
+
+        struct Step {
+            Node * node;
+            size_t idx;
+            bool direct;
+            size_t size;
+        };
+        std::vector<Step> path;
+        path.reserve(16);
+        path.push_back({root});
+
+        for (size_t i = 0; i < n; ++i) {
+            const Slice & k = ks[i];
+            size_t t = 0;
+            if (i != 0) {
+                const Slice & prev = ks[i - 1];
+                auto byte_at = [](const Slice & s, size_t pos) {
+                    return pos < s.size() ? CharToUint8(s[pos]) : static_cast<uint8_t>(0);
+                };
+                size_t end = std::max(prev.size(), k.size());
+                K_DIFF diff_at = 0;
+                while (diff_at < end && byte_at(prev, diff_at) == byte_at(k, diff_at)) {
+                    ++diff_at;
+                }
+                if (diff_at == end) { // 相同的 Key
+                    t = path.size();
+                } else {
+                    uint8_t shift = (__builtin_clz(byte_at(prev, diff_at) ^ byte_at(k, diff_at)) ^ 31);
+                    K_DIFF packed_diff = PackDiffAtAndShift(diff_at, shift);
+                    // 某层经过的 diff 中最大的是 diffs_[idx], 小于分叉位置则该层判定不变
+                    while (t < path.size() &&
+                           (path[t].size <= 1 || path[t].node->diffs_[path[t].idx] < packed_diff)) {
+                        ++t;
+                    }
+                }
+            }
+
+            if (t != path.size()) {
+                path.resize(t + 1);
+                Node * cursor = path[t].node;
+                while (true) {
+                    auto[idx, direct, size] = FindBestMatch(cursor, k);
+                    path.back() = {cursor, idx, direct, size};
+                    const auto & rep = cursor->reps_[idx + direct];
+                    if (!IsPacked(rep)) {
+                        break;
+                    }
+                    cursor = OffsetToMemNode(Unpack(rep));
+                    path.push_back({cursor});
+                }
+            }
+
+            const Step & leaf = path.back();
+            Match match{leaf.node, leaf.idx, leaf.direct, leaf.size, nullptr, 0, false, 0, path.size() - 1};
+            if (path.size() > 1) {
+                const Step & parent = path[path.size() - 2];
+                match.parent = parent.node;
+                match.parent_idx = parent.idx;
+                match.parent_direct = parent.direct;
+                match.parent_size = parent.size;
+            }
+            callback(i, match);
+        }
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    template<typename V, typename IF_DUP_CALLBACK>
+    size_t SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    MultiAdd(const Slice * ks, const V * vs, size_t n,
+             IF_DUP_CALLBACK && if_dup_callback) {
+        MarkModified();
+        auto add = [&](size_t i) -> bool {
+            if constexpr (std::is_same<std::decay_t<IF_DUP_CALLBACK>, std::false_type>::value) {
+                return Add(ks[i], vs[i]);
+            } else {
+                return Add(ks[i], vs[i], if_dup_callback);
+            }
+        };
+
+        size_t added = 0;
+#if defined(SGT_OPTIMISTIC_LOCK) || defined(SGT_COPY_ON_WRITE) || defined(SGT_SUBTREE_COUNT)
+        // 并发写入、路径复制与上层计数都需逐个下降
+        for (size_t i = 0; i < n; ++i) {
+            added += add(i);
+        }
+#else
+        size_t first = 0;
+        if (n != 0 && NodeSize(OffsetToMemNode(kRootOffset)) == 0) {
+            added += add(first++);
+        }
+        if (first == n) {
+            return added;
+        }
+
+        std::vector<size_t> order(n - first);
+        std::iota(order.begin(), order.end(), first);
+        std::stable_sort(order.begin(), order.end(), [ks](size_t a, size_t b) {
+            return SliceComparator()(ks[a], ks[b]);
+        });
+        std::vector<Slice> sorted(order.size());
+        for (size_t j = 0; j < order.size(); ++j) {
+            sorted[j] = ks[order[j]];
+        }
+        std::vector<Match> matches(order.size());
+        SortedFindBestMatch(sorted.data(), sorted.size(), [&matches](size_t j, const Match & match) {
+            matches[j] = match;
+        });
+
+        // 插入点在最终 Node 内时可就地合并, 新 diff 位于 diffs_[pos] 之前, 新 rep 位于 reps_[pos + direct] 之前
+        // 位置由插入前的 Node 算出, pos 互不相同的插入互不影响
+        struct Insert {
+            Node * node;
+            size_t pos;
+            bool direct;
+            K_DIFF diff;
+            size_t j;
+        };
+        std::vector<Insert> inserts;
+        std::vector<size_t> fallback;
+        for (size_t j = 0; j < sorted.size(); ++j) {
+            const Slice & k = sorted[j];
+            assert(k.size() < kMaxKeyLength);
+            const Match & match = matches[j];
+            auto & rep = match.node->reps_[match.idx + match.direct];
+            auto && trans = helper_->Trans(rep);
+            if (trans == k) {
+                if constexpr (!std::is_same<std::decay_t<IF_DUP_CALLBACK>, std::false_type>::value) {
+                    added += if_dup_callback(trans, rep);
+                }
+                continue;
+            }
+
+            const Slice & opponent = trans.Key();
+            K_DIFF diff_at = 0;
+            char a, b;
+            while ((a = opponent[diff_at]) == (b = k[diff_at])) {
+                ++diff_at;
+            }
+            uint8_t shift = (__builtin_clz(CharToUint8(a ^ b)) ^ 31);
+            auto direct = ((CharToUint8(b) >> shift) & 1);
+            K_DIFF packed_diff = PackDiffAtAndShift(diff_at, shift);
+
+            // 插入点在上层 Node
+            if (match.parent != nullptr && packed_diff < match.parent->diffs_[match.parent_idx]) {
+                fallback.emplace_back(j);
+                continue;
+            }
+
+            // 同 CombatInsert, 自 Node 顶部按 k 的 crit bit 下行, 直到遇到大于 packed_diff 的 diff 或 opponent
+            Node * node = match.node;
+            size_t insert_idx = match.idx;
+            bool insert_direct = match.direct;
+            if (match.size > 1 && packed_diff < node->diffs_[match.idx]) {
+                const K_DIFF * cbegin = node->diffs_.cbegin();
+                const K_DIFF * cend = &node->diffs_[match.size - 1];
+
+                K_DIFF exist_diff;
+                auto pyramid = node->pyramid_;
+                const K_DIFF * min_it = cbegin + node->pyramid_.MinAt(cbegin, cend, &exist_diff);
+                while (true) {
+                    assert(min_it == std::min_element(cbegin, cend) && *min_it == exist_diff);
+                    if (exist_diff > packed_diff) {
+                        insert_idx = (!direct ? cbegin : (cend - 1)) - node->diffs_.cbegin();
+                        insert_direct = direct;
+                        break;
+                    }
+
+                    auto[crit_diff_at, crit_shift] = UnpackDiffAtAndShift(exist_diff);
+                    uint8_t crit_byte = k.size() > crit_diff_at
+                                        ? CharToUint8(k[crit_diff_at])
+                                        : static_cast<uint8_t>(0);
+                    auto crit_direct = ((crit_byte >> crit_shift) & 1);
+                    if (!crit_direct) {
+                        cend = min_it;
+                        assert(cbegin != cend);
+                        min_it = node->diffs_.cbegin() +
+                                 pyramid.TrimRight(node->diffs_.cbegin(), cbegin, cend, &exist_diff);
+                    } else {
+                        cbegin = min_it + 1;
+                        assert(cbegin != cend);
+                        min_it = node->diffs_.cbegin() +
+                                 pyramid.TrimLeft(node->diffs_.cbegin(), cbegin, cend, &exist_diff);
+                    }
+                }
+            }
+            inserts.push_back({node, insert_idx + insert_direct, static_cast<bool>(direct), packed_diff, j});
+        }
+
+        std::sort(inserts.begin(), inserts.end(), [](const Insert & a, const Insert & b) {
+            return a.node != b.node ? a.node < b.node : (a.pos != b.pos ? a.pos < b.pos : a.j < b.j);
+        });
+        for (auto it = inserts.begin(); it != inserts.end();) {
+            Node * node = it->node;
+            auto end = std::find_if(it, inserts.end(), [node](const Insert & insert) {
+                return insert.node != node;
+            });
+
+            // 同一 opponent 旁的多个插入互相影响位置, 只保留第一个; 余量不足的部分同样退回
+            size_t size = NodeSize(node);
+            size_t room = node->reps_.size() - size;
+            auto last = it;
+            for (auto cur = it; cur != end; ++cur) {
+                if (last != it && cur->pos == (last - 1)->pos) {
+                    fallback.emplace_back(cur->j);
+                } else if (static_cast<size_t>(last - it) == room) {
+                    fallback.emplace_back(cur->j);
+                } else {
+                    *last++ = *cur;
+                }
+            }
+
+            // 自右向左一次移动到位
+            if (last != it) {
+                size_t shift = last - it;
+                size_t reps_end = size;
+                size_t diffs_end = size - 1;
+                for (auto cur = last; cur != it;) {
+                    --cur;
+                    size_t rep_pos = cur->pos + cur->direct;
+                    memmove(&node->reps_[rep_pos + shift], &node->reps_[rep_pos],
+                            sizeof(KV_REP) * (reps_end - rep_pos));
+                    memmove(&node->diffs_[cur->pos + shift], &node->diffs_[cur->pos],
+                            sizeof(K_DIFF) * (diffs_end - cur->pos));
+                    reps_end = rep_pos;
+                    diffs_end = cur->pos;
+
+                    size_t i = order[cur->j];
+                    if constexpr (std::is_convertible<const V &, KV_REP>::value) {
+                        node->reps_[rep_pos + shift - 1] = vs[i];
+                    } else {
+                        node->reps_[rep_pos + shift - 1] = helper_->Add(ks[i], vs[i]);
+                    }
+                    node->diffs_[cur->pos + shift - 1] = cur->diff;
+                    --shift;
+                }
+                node->size_ = static_cast<uint32_t>(size + (last - it));
+                NodeBuildGrown(node, size, it->pos);
+                added += last - it;
+            }
+            it = end;
+        }
+
+        std::sort(fallback.begin(), fallback.end());
+        for (size_t j:fallback) {
+            added += add(order[j]);
+        }
+#endif
+        return added;
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    size_t SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    MultiDel(const Slice * ks, size_t n) {
+        MarkModified();
+        size_t deleted = 0;
+#if defined(SGT_OPTIMISTIC_LOCK) || defined(SGT_COPY_ON_WRITE) || defined(SGT_SUBTREE_COUNT)
+        for (size_t i = 0; i < n; ++i) {
+            deleted += Del(ks[i]);
+        }
+#else
+        if (n == 0 || NodeSize(OffsetToMemNode(kRootOffset)) == 0) {
+            return 0;
+        }
+
+        std::vector<Slice> sorted(ks, ks + n);
+        std::sort(sorted.begin(), sorted.end(), SliceComparator());
+        sorted.erase(std::unique(sorted.begin(), sorted.end(), [](const Slice & a, const Slice & b) {
+            return !SliceComparator()(a, b) && !SliceComparator()(b, a);
+        }), sorted.end());
+
+        struct Hit {
+            Match match;
+            size_t pos;
+            size_t j;
+        };
+        std::vector<Hit> hits;
+        SortedFindBestMatch(sorted.data(), sorted.size(), [&](size_t j, const Match & match) {
+            size_t pos = match.idx + match.direct;
+            if (helper_->Trans(match.node->reps_[pos]) == sorted[j]) {
+                hits.push_back({match, pos, j});
+            }
+        });
+
+        // 升序 Key 的命中在同一 Node 内位置递增, 按 Node 稳定归组即可
+        std::stable_sort(hits.begin(), hits.end(), [](const Hit & a, const Hit & b) {
+            return a.match.node < b.match.node;
+        });
+        std::vector<KV_TRANS> transes;
+        std::vector<Slice> fallback;
+        auto it = hits.begin();
+        for (auto cur = hits.begin(); cur != hits.end();) {
+            Node * node = cur->match.node;
+            auto end = std::find_if(cur, hits.end(), [node](const Hit & hit) {
+                return hit.match.node != node;
+            });
+            // 清空非 root Node 需要连带修改 parent, 交给 Del
+            if (cur->match.parent != nullptr && static_cast<size_t>(end - cur) >= NodeSize(node)) {
+                for (; cur != end; ++cur) {
+                    fallback.emplace_back(sorted[cur->j]);
+                }
+                continue;
+            }
+            for (; cur != end; ++cur) {
+                transes.emplace_back(helper_->Trans(node->reps_[cur->pos]));
+                *it++ = *cur;
+            }
+        }
+        hits.erase(it, hits.end());
+        if (!transes.empty()) {
+            helper_->MultiDel(transes.data(), transes.size());
+        }
+
+        // 逐 Node 压缩, 相邻两个剩余 rep 之间的 diff 为原区间内 diff 的最小值
+        std::vector<Hit> touched;
+        for (auto cur = hits.begin(); cur != hits.end();) {
+            Node * node = cur->match.node;
+            size_t size = NodeSize(node);
+            size_t first = cur->pos;
+            size_t w = 0;
+            K_DIFF gap = std::numeric_limits<K_DIFF>::max();
+            for (size_t r = 0; r < size; ++r) {
+                if (cur != hits.end() && cur->match.node == node && cur->pos == r) {
+                    ++cur;
+                } else {
+                    if (w > 0) {
+                        node->diffs_[w - 1] = gap;
+                    }
+                    node->reps_[w++] = node->reps_[r];
+                    gap = std::numeric_limits<K_DIFF>::max();
+                }
+                if (r + 1 < size) {
+                    gap = std::min(gap, node->diffs_[r]);
+                }
+            }
+            deleted += size - w;
+            node->size_ = static_cast<uint32_t>(w);
+            if (SGT_LIKELY(w > 0)) {
+                NodeBuild(node, first > 0 ? first - 1 : 0);
+            }
+            touched.push_back(*(cur - 1));
+        }
+
+        // 自深向浅检查合并, 子 Node 并入后 parent 才轮到检查
+        std::stable_sort(touched.begin(), touched.end(), [](const Hit & a, const Hit & b) {
+            return a.match.depth > b.match.depth;
+        });
+        for (const Hit & hit:touched) {
+            Node * node = hit.match.node;
+            Node * parent = hit.match.parent;
+            if (parent == nullptr) {
+                continue;
+            }
+            size_t size = NodeSize(node);
+            size_t parent_size = NodeSize(parent);
+            if (parent->reps_.size() - parent_size + 1 >= size) {
+                size_t idx = 0;
+                while (!IsPacked(parent->reps_[idx]) || OffsetToMemNode(Unpack(parent->reps_[idx])) != node) {
+                    ++idx;
+                }
+                NodeMerge(parent, idx, false, parent_size,
+                          node, size);
+            }
+        }
+
+        Node * root = OffsetToMemNode(kRootOffset);
+        if (KV_REP r; NodeSize(root) == 1 && (r = root->reps_[0], IsPacked(r))) {
+            Node * child = OffsetToMemNode(Unpack(r));
+            NodeMerge(root, 0, false, 1,
+                      child, NodeSize(child));
+        }
+
+        for (const Slice & k:fallback) {
+            deleted += Del(k);
+        }
+#endif
+        return deleted;
+    }
 }
 
 #endif //SIG_TREE_SIG_TREE_MOP_IMPL_H
@@ -14,22 +14,88 @@ namespace sgt {
 }
 #endif
 
+#ifdef SGT_OPTIMISTIC_LOCK
+#include <thread>
+#endif
+
 #include "likely.h"
 #include "sig_tree.h"
 
 namespace sgt {
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
-    size_t SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    size_t SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
     NodeSize(const Node * node) {
         return node->size_;
     }
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
-    bool SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    bool SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
     IsNodeFull(const Node * node) {
         return node->size_ == kNodeRepRank;
     }
 
+#ifdef SGT_OPTIMISTIC_LOCK
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    bool SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    NodeReadLock(const Node * node, uint32_t * version) {
+        uint32_t v;
+        while ((v = __atomic_load_n(&node->version_, __ATOMIC_ACQUIRE)) & kNodeLocked) {
+            std::this_thread::yield();
+        }
+        *version = v;
+        return !(v & kNodeObsolete);
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    bool SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    NodeValidate(const Node * node, uint32_t version) {
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        return __atomic_load_n(&node->version_, __ATOMIC_RELAXED) == version;
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    bool SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    NodeUpgradeLock(Node * node, uint32_t version) {
+        return __atomic_compare_exchange_n(&node->version_, &version, version | kNodeLocked,
+                                           false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    NodeLock(Node * node) {
+        uint32_t version;
+        while (true) {
+            bool ok = NodeReadLock(node, &version);
+            assert(ok);
+            static_cast<void>(ok);
+            if (NodeUpgradeLock(node, version)) {
+                break;
+            }
+        }
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    NodeUnlock(Node * node) {
+        assert(node->version_ & kNodeLocked);
+        __atomic_store_n(&node->version_, (node->version_ & ~kNodeLocked) + kNodeVersionStep, __ATOMIC_RELEASE);
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    NodeUnlockUnchanged(Node * node) {
+        assert(node->version_ & kNodeLocked);
+        __atomic_store_n(&node->version_, node->version_ & ~kNodeLocked, __ATOMIC_RELEASE);
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    NodeUnlockObsolete(Node * node) {
+        __atomic_store_n(&node->version_, ((node->version_ & ~kNodeLocked) + kNodeVersionStep) | kNodeObsolete,
+                         __ATOMIC_RELEASE);
+    }
+#endif
+
     template<typename T>
     inline const T * SmartMinElem8(const T * from, const T * to, T * min_val) {
         if constexpr (std::is_same<T, uint16_t>::value && kHasMinpos) {
@@ -66,9 +132,9 @@ namespace sgt {
         }
     }
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
     template<size_t RANK>
-    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
     NodeTpl<RANK>::Pyramid::Build(const K_DIFF * from, const K_DIFF * to, size_t rebuild_idx) {
         size_t size = to - from;
         if (size <= 8) {
@@ -127,9 +193,9 @@ namespace sgt {
         }
     }
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
     template<size_t RANK>
-    size_t SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
+    size_t SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
     NodeTpl<RANK>::Pyramid::MinAt(const K_DIFF * from, const K_DIFF * to,
                                   K_DIFF * min_val) const {
         size_t size = to - from;
@@ -142,9 +208,9 @@ namespace sgt {
         return CalcOffset(PyramidHeight(size) - 1, 0, min_val);
     }
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
     template<size_t RANK>
-    size_t SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
+    size_t SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
     NodeTpl<RANK>::Pyramid::TrimLeft(const K_DIFF * cbegin, const K_DIFF * from, const K_DIFF * to,
                                      K_DIFF * min_val) {
         size_t pos = from - cbegin;
@@ -185,9 +251,9 @@ namespace sgt {
         return CalcOffset(level - 1, pos, min_val);
     }
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
     template<size_t RANK>
-    size_t SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
+    size_t SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
     NodeTpl<RANK>::Pyramid::TrimRight(const K_DIFF * cbegin, const K_DIFF * from, const K_DIFF * to,
                                       K_DIFF * min_val) {
         size_t pos = from - cbegin;
@@ -230,9 +296,9 @@ namespace sgt {
         return CalcOffset(level - 1, pos, min_val);
     }
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
     template<size_t RANK>
-    size_t SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
+    size_t SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
     NodeTpl<RANK>::Pyramid::CalcOffset(size_t level, size_t index, K_DIFF * min_val) const {
         size_t i = kAbsOffsets[level] + index;
         if (min_val != nullptr) { *min_val = vals_[i]; }
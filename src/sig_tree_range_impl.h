@@ -0,0 +1,934 @@
+#pragma once
+#ifndef SIG_TREE_SIG_TREE_RANGE_IMPL_H
+#define SIG_TREE_SIG_TREE_RANGE_IMPL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "likely.h"
+#include "sig_tree.h"
+#include "sig_tree_visit_impl.h"
+
+namespace sgt {
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    size_t SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    DeleteRange(const Slice & lo, const Slice & hi) {
+        MarkModified();
+        if (hi.size() != 0 && !SliceComparator()(lo, hi)) {
+            return 0;
+        }
+#if defined(SGT_OPTIMISTIC_LOCK) || defined(SGT_COPY_ON_WRITE) || defined(SGT_SUBTREE_COUNT)
+        // 摘下子树须同时处理锁、快照共享与上层计数, 退回逐个 Del
+        std::vector<std::string> ks;
+        Visit<kForward>(lo, [&](const KV_REP & rep) {
+            auto && trans = helper_->Trans(rep);
+            const Slice & k = trans.Key();
+            if (hi.size() != 0 && !SliceComparator()(k, hi)) {
+                return false;
+            }
+            ks.emplace_back(k.data(), k.size());
+            return true;
+        });
+        size_t deleted = 0;
+        for (const auto & k:ks) {
+            deleted += Del(k);
+        }
+        return deleted;
+#else
+        Node * root = OffsetToMemNode(kRootOffset);
+        if (SGT_UNLIKELY(NodeSize(root) == 0)) {
+            return 0;
+        }
+
+        Path lo_path;
+        if (lo.size() == 0) {
+            PathLeftmost(&lo_path, root);
+        } else {
+            PathSeek(&lo_path, lo);
+        }
+        if (lo_path.empty()) {
+            return 0;
+        }
+        Path hi_path;
+        if (hi.size() != 0) {
+            PathSeek(&hi_path, hi);
+        }
+
+        std::vector<KV_TRANS> transes;
+        std::vector<size_t> pages;
+        size_t deleted = DeleteRangeImpl(root, &lo_path, !hi_path.empty() ? &hi_path : nullptr, 0,
+                                         &transes, &pages);
+        if (KV_REP r; NodeSize(root) == 1 && (r = root->reps_[0], IsPacked(r))) {
+            Node * child = OffsetToMemNode(Unpack(r));
+            NodeMerge(root, 0, false, 1,
+                      child, NodeSize(child));
+        }
+
+        if (!transes.empty()) {
+            helper_->MultiDel(transes.data(), transes.size());
+        }
+        for (size_t offset:pages) {
+            allocator_->FreePage(offset);
+        }
+        return deleted;
+#endif
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    size_t SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    DeleteRangeImpl(Node * node, const Path * lo, const Path * hi, size_t depth,
+                    std::vector<KV_TRANS> * transes, std::vector<size_t> * pages) {
+        size_t size = NodeSize(node);
+        assert(lo == nullptr || (*lo)[depth].first == node);
+        assert(hi == nullptr || (*hi)[depth].first == node);
+
+        // lo 一侧 rep 自身不小于 lo, 整体删除; hi 一侧 rep 自身不小于 hi, 予以保留
+        // 路径继续向下时该 rep 是部分覆盖的子树
+        size_t from = lo != nullptr ? (*lo)[depth].second : 0;
+        size_t to = hi != nullptr ? (*hi)[depth].second : size;
+        bool lo_partial = lo != nullptr && depth + 1 < lo->size();
+        bool hi_partial = hi != nullptr && depth + 1 < hi->size();
+
+        auto child_at = [this, node](size_t rep_idx) {
+            return OffsetToMemNode(Unpack(node->reps_[rep_idx]));
+        };
+        auto try_merge = [this, node](size_t rep_idx, Node * child) {
+            size_t node_size = NodeSize(node);
+            size_t child_size = NodeSize(child);
+            if (node->reps_.size() - node_size + 1 >= child_size) {
+                NodeMerge(node, rep_idx, false, node_size,
+                          child, child_size);
+            }
+        };
+
+        if (from >= to) {
+            // 两条路径落在同一 rep 上, 只要 hi 路径继续向下, 该子树中 hi 之前的部分就须删除
+            // lo 路径不再向下时该 rep 整体不小于 lo, 子树内不设下界
+            // 仅 lo 路径继续向下时该 rep 整体不小于 hi, 无需删除
+            if (from == to && hi_partial) {
+                Node * child = child_at(from);
+                size_t deleted = DeleteRangeImpl(child, lo_partial ? lo : nullptr, hi, depth + 1, transes, pages);
+                try_merge(from, child);
+                return deleted;
+            }
+            return 0;
+        }
+
+        size_t deleted = 0;
+        for (size_t i = from + lo_partial; i < to; ++i) {
+            deleted += DeleteRangeDrop(node->reps_[i], transes, pages);
+        }
+
+        Node * lo_child = nullptr;
+        Node * hi_child = nullptr;
+        size_t remove_from = from;
+        size_t remove_to = to;
+        if (lo_partial) {
+            lo_child = child_at(from);
+            deleted += DeleteRangeImpl(lo_child, lo, nullptr, depth + 1, transes, pages);
+            if (NodeSize(lo_child) != 0) {
+                ++remove_from;
+            } else {
+                pages->emplace_back(Unpack(node->reps_[from]));
+                lo_child = nullptr;
+            }
+        }
+        if (hi_partial) {
+            hi_child = child_at(to);
+            deleted += DeleteRangeImpl(hi_child, nullptr, hi, depth + 1, transes, pages);
+            if (NodeSize(hi_child) == 0) {
+                pages->emplace_back(Unpack(node->reps_[to]));
+                hi_child = nullptr;
+                ++remove_to;
+            }
+        }
+
+        if (remove_from != remove_to) {
+            NodeRemoveRange(node, remove_from, remove_to);
+        }
+        // 先右后左, 合并右侧子树不影响左侧子树的位置
+        if (hi_child != nullptr) {
+            try_merge(remove_from, hi_child);
+        }
+        if (lo_child != nullptr) {
+            try_merge(from, lo_child);
+        }
+        return deleted;
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    size_t SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    DeleteRangeDrop(const KV_REP & rep,
+                    std::vector<KV_TRANS> * transes, std::vector<size_t> * pages) {
+        if (!IsPacked(rep)) {
+            transes->emplace_back(helper_->Trans(rep));
+            return 1;
+        }
+        size_t offset = Unpack(rep);
+        const Node * node = OffsetToMemNode(offset);
+        size_t deleted = 0;
+        for (size_t i = 0; i < NodeSize(node); ++i) {
+            deleted += DeleteRangeDrop(node->reps_[i], transes, pages);
+        }
+        pages->emplace_back(offset);
+        return deleted;
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    template<bool BACKWARD, bool INCLUSIVE>
+    KV_REP * SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    Bound(const Slice & k) {
+        Node * root = OffsetToMemNode(kRootOffset);
+        if (SGT_UNLIKELY(NodeSize(root) == 0)) {
+            return nullptr;
+        }
+
+        // 下降时只记下最深一层的左右兄弟, 目标落在子树边缘时由其补位, 无需回溯
+        KV_REP * prev = nullptr;
+        KV_REP * next = nullptr;
+        auto step = [&prev, &next](Node * node, size_t rep_idx) {
+            if (rep_idx > 0) {
+                prev = &node->reps_[rep_idx - 1];
+            }
+            if (rep_idx + 1 < NodeSize(node)) {
+                next = &node->reps_[rep_idx + 1];
+            }
+        };
+        // 目标位于 node->reps_[lo, hi] 之前 (!direct) 或之后 (direct)
+        auto settle = [this, &prev, &next](Node * node, size_t lo, size_t hi, bool direct) -> KV_REP * {
+            KV_REP * rep;
+            if constexpr (!BACKWARD) {
+                rep = !direct ? &node->reps_[lo] : (hi + 1 < NodeSize(node) ? &node->reps_[hi + 1] : next);
+            } else {
+                rep = direct ? &node->reps_[hi] : (lo > 0 ? &node->reps_[lo - 1] : prev);
+            }
+            while (rep != nullptr && IsPacked(*rep)) {
+                Node * child = OffsetToMemNode(Unpack(*rep));
+                rep = &child->reps_[!BACKWARD ? 0 : NodeSize(child) - 1];
+            }
+            return rep;
+        };
+
+        Node * cursor = root;
+        Node * parent = nullptr;
+        size_t parent_idx{};
+        while (true) {
+            auto[idx, direct, size] = FindBestMatch(cursor, k);
+            size_t rep_idx = idx + direct;
+            KV_REP & rep = cursor->reps_[rep_idx];
+            if (IsPacked(rep)) {
+                step(cursor, rep_idx);
+                if (size > 1) {
+                    parent = cursor;
+                    parent_idx = idx;
+                }
+                cursor = OffsetToMemNode(Unpack(rep));
+                continue;
+            }
+
+            const auto & trans = helper_->Trans(rep);
+            if (trans == k) {
+                if constexpr (INCLUSIVE) {
+                    return &rep;
+                } else {
+                    return settle(cursor, rep_idx, rep_idx, !BACKWARD);
+                }
+            }
+
+            const Slice & opponent = trans.Key();
+            K_DIFF diff_at = 0;
+            char a, b;
+            while ((a = opponent[diff_at]) == (b = k[diff_at])) {
+                ++diff_at;
+            }
+            uint8_t shift = (__builtin_clz(CharToUint8(a ^ b)) ^ 31);
+            bool k_direct = ((CharToUint8(b) >> shift) & 1);
+            K_DIFF packed_diff = PackDiffAtAndShift(diff_at, shift);
+
+            // 分叉点在上层 Node 时自 root 重走一遍, 否则就在叶子所在的 Node 内收窄
+            if (parent != nullptr && packed_diff < parent->diffs_[parent_idx]) {
+                cursor = root;
+                prev = nullptr;
+                next = nullptr;
+            }
+            while (true) {
+                size_t cursor_size = NodeSize(cursor);
+                size_t lo = 0;
+                size_t hi = cursor_size - 1;
+                if (cursor_size > 1) {
+                    const K_DIFF * cbegin = cursor->diffs_.cbegin();
+                    const K_DIFF * cend = &cursor->diffs_[cursor_size - 1];
+
+                    K_DIFF exist_diff;
+                    auto pyramid = cursor->pyramid_;
+                    const K_DIFF * min_it = cbegin + pyramid.MinAt(cbegin, cend, &exist_diff);
+                    while (exist_diff < packed_diff) {
+                        auto[crit_diff_at, crit_shift] = UnpackDiffAtAndShift(exist_diff);
+                        uint8_t crit_byte = k.size() > crit_diff_at
+                                            ? CharToUint8(k[crit_diff_at])
+                                            : static_cast<uint8_t>(0);
+                        if (!((crit_byte >> crit_shift) & 1)) {
+                            cend = min_it;
+                            if (cbegin == cend) {
+                                break;
+                            }
+                            min_it = cursor->diffs_.cbegin() +
+                                     pyramid.TrimRight(cursor->diffs_.cbegin(), cbegin, cend, &exist_diff);
+                        } else {
+                            cbegin = min_it + 1;
+                            if (cbegin == cend) {
+                                break;
+                            }
+                            min_it = cursor->diffs_.cbegin() +
+                                     pyramid.TrimLeft(cursor->diffs_.cbegin(), cbegin, cend, &exist_diff);
+                        }
+                    }
+                    lo = cbegin - cursor->diffs_.cbegin();
+                    hi = cend - cursor->diffs_.cbegin();
+                }
+                if (lo == hi && IsPacked(cursor->reps_[lo])) {
+                    step(cursor, lo);
+                    cursor = OffsetToMemNode(Unpack(cursor->reps_[lo]));
+                    continue;
+                }
+                return settle(cursor, lo, hi, k_direct);
+            }
+        }
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    template<bool ORDERED, typename VISITOR>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    ParallelVisit(const Slice & lo, const Slice & hi, size_t num_workers, VISITOR && visitor) const {
+        Node * root = OffsetToMemNode(kRootOffset);
+        if (SGT_UNLIKELY(NodeSize(root) == 0) || (hi.size() != 0 && !SliceComparator()(lo, hi))) {
+            return;
+        }
+        Path lo_path;
+        if (lo.size() == 0) {
+            PathLeftmost(&lo_path, root);
+        } else {
+            PathSeek(&lo_path, lo);
+        }
+        if (lo_path.empty()) {
+            return;
+        }
+        Path hi_path;
+        if (hi.size() != 0) {
+            PathSeek(&hi_path, hi);
+        }
+
+        // 与 [lo, hi) 相交的 rep, hi 恰为其自身时不算
+        auto overlap = [&lo_path, &hi_path](const Path & prefix) {
+            if (PathCompare(prefix, lo_path) < 0) {
+                return false;
+            }
+            if (hi_path.empty()) {
+                return true;
+            }
+            int cmp = PathCompare(prefix, hi_path);
+            return cmp < 0 || (cmp == 0 && prefix.size() < hi_path.size());
+        };
+
+        // 逐层展开, 直到 part 数足以均衡各 worker 的负载, 每个 part 是指向某个 rep 的路径
+        num_workers = std::max(num_workers, static_cast<size_t>(1));
+        std::vector<Path> parts;
+        Path prefix;
+        prefix.emplace_back(root, 0);
+        for (size_t i = 0; i < NodeSize(root); ++i) {
+            prefix.back().second = i;
+            if (overlap(prefix)) {
+                parts.emplace_back(prefix);
+            }
+        }
+        std::vector<Path> next;
+        while (parts.size() < num_workers * 4) {
+            next.clear();
+            bool expanded = false;
+            for (const Path & part:parts) {
+                auto[node, rep_idx] = part.back();
+                const auto & rep = node->reps_[rep_idx];
+                if (!IsPacked(rep)) {
+                    next.emplace_back(part);
+                    continue;
+                }
+                expanded = true;
+                Node * child = OffsetToMemNode(Unpack(rep));
+                prefix = part;
+                prefix.emplace_back(child, 0);
+                for (size_t i = 0; i < NodeSize(child); ++i) {
+                    prefix.back().second = i;
+                    if (overlap(prefix)) {
+                        next.emplace_back(prefix);
+                    }
+                }
+            }
+            parts.swap(next);
+            if (!expanded) {
+                break;
+            }
+        }
+
+        // 自 part 的起点逐个前进, 离开 part 所指的子树或到达 hi 时结束, emit 返回 false 时中止
+        auto scan = [this, &lo_path, &hi_path](const Path & part, auto && emit) {
+            Path que;
+            if (PathCompare(part, lo_path) == 0) {
+                que = lo_path;
+            } else {
+                que = part;
+                const auto & rep = part.back().first->reps_[part.back().second];
+                if (IsPacked(rep)) {
+                    PathLeftmost(&que, OffsetToMemNode(Unpack(rep)));
+                }
+            }
+            size_t depth = part.size();
+            while (!que.empty() && que.size() >= depth && que[depth - 1] == part.back()) {
+                if (!hi_path.empty() && que.back() == hi_path.back()) {
+                    break;
+                }
+                auto[node, rep_idx] = que.back();
+                if (!emit(node->reps_[rep_idx])) {
+                    return false;
+                }
+                PathNext(&que);
+            }
+            return true;
+        };
+
+        if (num_workers == 1 || parts.size() <= 1) {
+            for (size_t p = 0; p < parts.size(); ++p) {
+                if (!scan(parts[p], [&visitor, p](const KV_REP & rep) { return visitor(p, rep); })) {
+                    break;
+                }
+            }
+            return;
+        }
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::atomic<size_t> cursor(0);
+        std::atomic<bool> stop(false);
+        std::exception_ptr error;
+        auto fail = [&]() {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+            stop.store(true, std::memory_order_relaxed);
+            cv.notify_all();
+        };
+        std::vector<std::thread> workers;
+
+        if constexpr (!ORDERED) {
+            auto work = [&]() {
+                size_t p;
+                while (!stop.load(std::memory_order_relaxed) &&
+                       (p = cursor.fetch_add(1, std::memory_order_relaxed)) < parts.size()) {
+                    try {
+                        if (!scan(parts[p], [&](const KV_REP & rep) {
+                            return !stop.load(std::memory_order_relaxed) && visitor(p, rep);
+                        })) {
+                            stop.store(true, std::memory_order_relaxed);
+                        }
+                    } catch (...) {
+                        fail();
+                    }
+                }
+            };
+            workers.reserve(num_workers - 1);
+            for (size_t i = 1; i < num_workers; ++i) {
+                workers.emplace_back(work);
+            }
+            work();
+            for (auto & worker:workers) {
+                worker.join();
+            }
+        } else {
+            // worker 至多领先调用线程 window 个 part, 限制缓冲的大小
+            struct Buffer {
+                std::vector<KV_REP> reps;
+                bool done = false;
+            };
+            std::vector<Buffer> buffers(parts.size());
+            size_t window = num_workers * 2;
+            size_t consumed = 0;
+            auto work = [&]() {
+                size_t p;
+                while ((p = cursor.fetch_add(1, std::memory_order_relaxed)) < parts.size()) {
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        cv.wait(lock, [&]() {
+                            return stop.load(std::memory_order_relaxed) || p < consumed + window;
+                        });
+                    }
+                    if (stop.load(std::memory_order_relaxed)) {
+                        break;
+                    }
+                    try {
+                        std::vector<KV_REP> reps;
+                        scan(parts[p], [&](const KV_REP & rep) {
+                            reps.emplace_back(rep);
+                            return !stop.load(std::memory_order_relaxed);
+                        });
+                        std::lock_guard<std::mutex> lock(mutex);
+                        buffers[p].reps.swap(reps);
+                        buffers[p].done = true;
+                        cv.notify_all();
+                    } catch (...) {
+                        fail();
+                    }
+                }
+            };
+            workers.reserve(num_workers);
+            for (size_t i = 0; i < num_workers; ++i) {
+                workers.emplace_back(work);
+            }
+
+            try {
+                for (size_t p = 0; p < parts.size(); ++p) {
+                    std::vector<KV_REP> reps;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        cv.wait(lock, [&]() {
+                            return stop.load(std::memory_order_relaxed) || buffers[p].done;
+                        });
+                        if (!buffers[p].done) { // worker 出错
+                            break;
+                        }
+                        reps.swap(buffers[p].reps);
+                        consumed = p + 1;
+                    }
+                    cv.notify_all();
+                    if (!std::all_of(reps.cbegin(), reps.cend(), [&visitor, p](const KV_REP & rep) {
+                        return visitor(p, rep);
+                    })) {
+                        break;
+                    }
+                }
+            } catch (...) {
+                fail();
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop.store(true, std::memory_order_relaxed);
+            }
+            cv.notify_all();
+            for (auto & worker:workers) {
+                worker.join();
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    template<typename VISITOR>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    VisitPrefix(const Slice & prefix, VISITOR && visitor) const {
+        auto[node, lo, hi] = FindPrefix(prefix);
+        if (node == nullptr) {
+            return;
+        }
+        for (size_t i = lo; i <= hi; ++i) {
+            if (!VisitSubtree(node->reps_[i], visitor)) {
+                break;
+            }
+        }
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    size_t SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    CountPrefix(const Slice & prefix) const {
+        auto[node, lo, hi] = FindPrefix(prefix);
+        if (node == nullptr) {
+            return 0;
+        }
+#ifdef SGT_SUBTREE_COUNT
+        return NodeCount(node, lo, hi + 1);
+#else
+        size_t cnt = 0;
+        for (size_t i = lo; i <= hi; ++i) {
+            cnt += CountSubtree(node->reps_[i]);
+        }
+        return cnt;
+#endif
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    std::tuple<typename SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::Node *, size_t, size_t>
+    SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    FindPrefix(const Slice & prefix) const {
+        assert(prefix.size() < kMaxKeyLength);
+        Node * cursor = OffsetToMemNode(kRootOffset);
+        if (SGT_UNLIKELY(NodeSize(cursor) == 0)) {
+            return {nullptr, 0, 0};
+        }
+
+        // diff_at 小于 prefix.size() 的 crit bit 按 prefix 选择方向, 余下的 reps 共享前 prefix.size() 个字节
+        const K_DIFF limit = static_cast<K_DIFF>(prefix.size()) << 3;
+        while (true) {
+            size_t size = NodeSize(cursor);
+            size_t lo = 0;
+            size_t hi = size - 1;
+            if (size > 1) {
+                const K_DIFF * cbegin = cursor->diffs_.cbegin();
+                const K_DIFF * cend = &cursor->diffs_[size - 1];
+
+                K_DIFF exist_diff;
+                auto pyramid = cursor->pyramid_;
+                const K_DIFF * min_it = cbegin + pyramid.MinAt(cbegin, cend, &exist_diff);
+                while (exist_diff < limit) {
+                    auto[crit_diff_at, crit_shift] = UnpackDiffAtAndShift(exist_diff);
+                    if (!((CharToUint8(prefix[crit_diff_at]) >> crit_shift) & 1)) {
+                        cend = min_it;
+                        if (cbegin == cend) {
+                            break;
+                        }
+                        min_it = cursor->diffs_.cbegin() +
+                                 pyramid.TrimRight(cursor->diffs_.cbegin(), cbegin, cend, &exist_diff);
+                    } else {
+                        cbegin = min_it + 1;
+                        if (cbegin == cend) {
+                            break;
+                        }
+                        min_it = cursor->diffs_.cbegin() +
+                                 pyramid.TrimLeft(cursor->diffs_.cbegin(), cbegin, cend, &exist_diff);
+                    }
+                }
+                lo = cbegin - cursor->diffs_.cbegin();
+                hi = cend - cursor->diffs_.cbegin();
+            }
+            if (lo == hi && IsPacked(cursor->reps_[lo])) {
+                cursor = OffsetToMemNode(Unpack(cursor->reps_[lo]));
+                continue;
+            }
+
+            // 这些 Key 的公共前缀是否就是 prefix, 比较其中任意一个即可
+            const KV_REP * rep = &cursor->reps_[lo];
+            while (IsPacked(*rep)) {
+                rep = &OffsetToMemNode(Unpack(*rep))->reps_[0];
+            }
+            auto && trans = helper_->Trans(*rep);
+            const Slice & k = trans.Key();
+            if (k.size() < prefix.size() || memcmp(k.data(), prefix.data(), prefix.size()) != 0) {
+                return {nullptr, 0, 0};
+            }
+            return {cursor, lo, hi};
+        }
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    template<typename VISITOR>
+    bool SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    VisitSubtree(const KV_REP & rep, VISITOR && visitor) const {
+        if (!IsPacked(rep)) {
+            return visitor(rep);
+        }
+        const Node * node = OffsetToMemNode(Unpack(rep));
+        for (size_t i = 0; i < NodeSize(node); ++i) {
+            if (!VisitSubtree(node->reps_[i], visitor)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    size_t SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    CountSubtree(const KV_REP & rep) const {
+        if (!IsPacked(rep)) {
+            return 1;
+        }
+        const Node * node = OffsetToMemNode(Unpack(rep));
+        size_t cnt = 0;
+        for (size_t i = 0; i < NodeSize(node); ++i) {
+            cnt += CountSubtree(node->reps_[i]);
+        }
+        return cnt;
+    }
+
+#ifdef SGT_SUBTREE_COUNT
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    size_t SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    Rank(const Slice & k) const {
+        if (k.size() == 0) {
+            return 0;
+        }
+        // 首个不小于 k 的 rep 之前的 Key 数, 即路径上每层其左侧各 rep 的计数之和
+        Path que;
+        PathSeek(&que, k);
+        if (que.empty()) {
+            return Size();
+        }
+        size_t rank = 0;
+        for (const auto & p:que) {
+            rank += NodeCount(p.first, 0, p.second);
+        }
+        return rank;
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    KV_REP * SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    Select(size_t i) {
+        if (i >= Size()) {
+            return nullptr;
+        }
+        Node * cursor = OffsetToMemNode(kRootOffset);
+        while (true) {
+            size_t idx = 0;
+            while (i >= cursor->counts_[idx]) {
+                i -= cursor->counts_[idx++];
+            }
+            auto & rep = cursor->reps_[idx];
+            if (!IsPacked(rep)) {
+                assert(i == 0);
+                return &rep;
+            }
+            cursor = OffsetToMemNode(Unpack(rep));
+        }
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    size_t SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    CountRange(const Slice & lo, const Slice & hi) const {
+        if (hi.size() == 0) {
+            return Size() - Rank(lo);
+        }
+        if (!SliceComparator()(lo, hi)) {
+            return 0;
+        }
+        return Rank(hi) - Rank(lo);
+    }
+#endif
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    unsigned SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    NodeRepDepth(const Node * node, size_t i) {
+        unsigned depth = 0;
+        if (i > 0) {
+            depth = node->diffs_[i - 1];
+        }
+        if (i + 1 < NodeSize(node)) {
+            depth = std::max<unsigned>(depth, node->diffs_[i]);
+        }
+        return depth;
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    double SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    NodeDepthBase(const Node * node) const {
+        double sum = 0;
+        size_t leaves = 0;
+        for (size_t i = 0; i < NodeSize(node); ++i) {
+            if (!IsPacked(node->reps_[i])) {
+                sum += NodeRepDepth(node, i);
+                ++leaves;
+            }
+        }
+        if (leaves == 0) {
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+        return sum / leaves - 1.33;
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    size_t SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    EstimateRange(const Slice & lo, const Slice & hi) const {
+#ifdef SGT_SUBTREE_COUNT
+        return CountRange(lo, hi);
+#else
+        if (hi.size() != 0 && !SliceComparator()(lo, hi)) {
+            return 0;
+        }
+        Node * root = OffsetToMemNode(kRootOffset);
+        if (SGT_UNLIKELY(NodeSize(root) == 0)) {
+            return 0;
+        }
+
+        // 两端各自首个不小于边界的 rep, hi_path 为空表示末尾
+        Path lo_path;
+        Path hi_path;
+        if (lo.size() == 0) {
+            PathLeftmost(&lo_path, root);
+        } else {
+            PathSeek(&lo_path, lo);
+        }
+        if (lo_path.empty()) {
+            return 0;
+        }
+        if (hi.size() != 0) {
+            PathSeek(&hi_path, hi);
+        }
+
+        // 两条路径自分叉的 Node 起, 中间的 rep 与其下沿 lo 的右侧、沿 hi 的左侧即 [lo, hi)
+        size_t fork = 0;
+        while (fork < lo_path.size() && fork < hi_path.size() && lo_path[fork] == hi_path[fork]) {
+            ++fork;
+        }
+        if (fork == lo_path.size()) { // 两端落在同一个 rep
+            return 0;
+        }
+
+        // 叶子直接计数, packed rep 入堆; 浅的 packed rep 子树通常更大, 优先展开
+        // 不再展开的 packed rep 按 NodeDepthBase 推算
+        typedef std::tuple<unsigned, double, const Node *, size_t> Packed; // depth, a, node, rep_idx
+        auto shallower = [](const Packed & x, const Packed & y) { return std::get<0>(x) > std::get<0>(y); };
+        std::priority_queue<Packed, std::vector<Packed>, decltype(shallower)> heap(shallower);
+        double cnt = 1; // lo_path 末端的叶子
+        auto span = [&](const Node * node, size_t from, size_t to) {
+            double a = 0;
+            bool calibrated = false;
+            for (size_t i = from; i < to; ++i) {
+                if (!IsPacked(node->reps_[i])) {
+                    cnt += 1;
+                    continue;
+                }
+                if (!calibrated) {
+                    calibrated = true;
+                    a = NodeDepthBase(node);
+                }
+                heap.emplace(NodeRepDepth(node, i), a, node, i);
+            }
+        };
+        const Node * node = lo_path[fork].first;
+        span(node, lo_path[fork].second + 1, hi_path.empty() ? NodeSize(node) : hi_path[fork].second);
+        for (size_t d = fork + 1; d < lo_path.size(); ++d) {
+            const auto & p = lo_path[d];
+            span(p.first, p.second + 1, NodeSize(p.first));
+        }
+        for (size_t d = fork + 1; d < hi_path.size(); ++d) {
+            const auto & p = hi_path[d];
+            span(p.first, 0, p.second);
+        }
+        for (size_t n = 0; n < kEstimateExpandNodes && !heap.empty(); ++n) {
+            node = OffsetToMemNode(Unpack(std::get<2>(heap.top())->reps_[std::get<3>(heap.top())]));
+            heap.pop();
+            span(node, 0, NodeSize(node));
+        }
+        for (; !heap.empty(); heap.pop()) {
+            auto[depth, a, parent, i] = heap.top();
+            if (std::isnan(a)) { // 退回以子 Node 的 rep 数为准
+                cnt += NodeSize(OffsetToMemNode(Unpack(parent->reps_[i])));
+            } else {
+                cnt += std::exp2(a - depth);
+            }
+        }
+        return static_cast<size_t>(cnt + 0.5);
+#endif
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    template<typename CALLBACK>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    DescendAt(const double * pos, size_t n, CALLBACK && callback) const {
+        std::vector<double> targets(pos, pos + n);
+        NodeDescendAt(OffsetToMemNode(kRootOffset), 1, targets.data(), 0, n, callback);
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    template<typename CALLBACK>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    NodeDescendAt(const Node * node, double weight, double * targets, size_t from, size_t to,
+                  CALLBACK && callback) const {
+        size_t size = NodeSize(node);
+        std::vector<double> weights(size);
+#ifdef SGT_SUBTREE_COUNT
+        for (size_t i = 0; i < size; ++i) {
+            weights[i] = node->counts_[i];
+        }
+#else
+        double a = NodeDepthBase(node);
+        if (std::isnan(a)) { // 全为 packed rep, 只需相对大小, 以最浅者为 1
+            a = NodeRepDepth(node, 0);
+            for (size_t i = 1; i < size; ++i) {
+                a = std::min<double>(a, NodeRepDepth(node, i));
+            }
+        }
+        for (size_t i = 0; i < size; ++i) {
+            weights[i] = IsPacked(node->reps_[i]) ? std::exp2(a - NodeRepDepth(node, i)) : 1;
+        }
+#endif
+        // 精确计数时本 Node 之和即父 Node 中的 weight, ratio 恰为 1, 位置不经舍入
+        double ratio = std::accumulate(weights.cbegin(), weights.cend(), 0.0) / weight;
+
+        size_t idx = 0;
+        double cum = 0;
+        for (size_t j = from; j < to;) {
+            double target = targets[j] * ratio;
+            while (idx + 1 < size && target >= cum + weights[idx]) {
+                cum += weights[idx++];
+            }
+            // 落在 reps_[idx] 的位置为 targets[j, end)
+            size_t end = j;
+            double upper = idx + 1 < size ? cum + weights[idx] : std::numeric_limits<double>::infinity();
+            for (; end < to && (target = targets[end] * ratio) < upper; ++end) {
+                targets[end] = std::clamp(target - cum, 0.0, std::nextafter(weights[idx], 0.0));
+            }
+
+            const KV_REP & rep = node->reps_[idx];
+            if (IsPacked(rep)) {
+                NodeDescendAt(OffsetToMemNode(Unpack(rep)), weights[idx], targets, j, end, callback);
+            } else {
+                for (; j < end; ++j) {
+                    callback(j, rep);
+                }
+            }
+            j = end;
+        }
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    template<typename RNG>
+    std::vector<KV_REP> SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    Sample(size_t k, RNG && rng) const {
+        std::vector<KV_REP> reps;
+        if (SGT_UNLIKELY(NodeSize(OffsetToMemNode(kRootOffset)) == 0)) {
+            return reps;
+        }
+        std::vector<double> pos(k);
+        std::uniform_real_distribution<double> dist(0, 1);
+        for (auto & p:pos) {
+            p = std::min(dist(rng), std::nextafter(1.0, 0.0));
+        }
+        std::sort(pos.begin(), pos.end());
+        reps.reserve(k);
+        DescendAt(pos.data(), k, [&reps](size_t, const KV_REP & rep) { reps.emplace_back(rep); });
+        return reps;
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    std::vector<KV_REP> SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    Quantiles(size_t q) const {
+        std::vector<KV_REP> reps;
+        if (SGT_UNLIKELY(NodeSize(OffsetToMemNode(kRootOffset)) == 0 || q < 2)) {
+            return reps;
+        }
+        std::vector<double> pos(q - 1);
+        for (size_t i = 1; i < q; ++i) {
+            pos[i - 1] = static_cast<double>(i) / q;
+        }
+        // 位置递增, 重复只会相邻
+        DescendAt(pos.data(), pos.size(), [&reps](size_t, const KV_REP & rep) {
+            if (reps.empty() || !(reps.back() == rep)) {
+                reps.emplace_back(rep);
+            }
+        });
+        return reps;
+    }
+}
+
+#endif //SIG_TREE_SIG_TREE_RANGE_IMPL_H
@@ -2,145 +2,335 @@
 #ifndef SIG_TREE_SIG_TREE_REBUILD_IMPL_H
 #define SIG_TREE_SIG_TREE_REBUILD_IMPL_H
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <string>
+#include <thread>
+
+#include "coding.h"
 #include "likely.h"
 #include "sig_tree.h"
 
 namespace sgt {
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
-    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
     Rebuild(SignatureTreeTpl * dst) const {
+        RebuildContext ctx;
+        Rebuild(dst, &ctx);
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    Rebuild(SignatureTreeTpl * dst, RebuildContext * ctx) const {
         assert(dst != this);
-        std::vector<Page> pool;
-        RebuildPageToNode(RebuildHeadNode(OffsetToMemNode(kRootOffset), dst, &pool),
+        ctx->Reset();
+        RebuildPageToNode(*RebuildSubtree(OffsetToMemNode(kRootOffset), dst, ctx),
                           dst->OffsetToMemNode(dst->kRootOffset));
     }
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
-    typename SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::Page
-    SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
-    RebuildHeadNode(const Node * node, SignatureTreeTpl * dst,
-                    std::vector<Page> * pool) const {
-        size_t size = NodeSize(node);
-        if (SGT_UNLIKELY(size <= 1)) {
-            return {{},
-                    {node->reps_.data(), node->reps_.data() + size}};
-        }
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    Rebuild(SignatureTreeTpl * dst, size_t num_threads) const {
+        RebuildContext ctx;
+        Rebuild(dst, num_threads, &ctx);
+    }
 
-        const K_DIFF * cbegin = node->diffs_.cbegin();
-        const K_DIFF * cend = &node->diffs_[size - 1];
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    Rebuild(SignatureTreeTpl * dst, size_t num_threads, RebuildContext * ctx) const {
+        assert(dst != this);
+        const Node * root = OffsetToMemNode(kRootOffset);
 
-        K_DIFF min_val;
-        auto pyramid = node->pyramid_;
-        const K_DIFF * min_it = cbegin + node->pyramid_.MinAt(cbegin, cend, &min_val);
+        // 逐层向下展开, 直到子树数足以均衡各线程的负载
+        // 展开过的上层 Node 留给最后的单线程拼接
+        std::vector<const Node *> tasks = {root};
+        std::vector<const Node *> next;
+        while (tasks.size() < num_threads * 4) {
+            next.clear();
+            for (const Node * node:tasks) {
+                size_t size = NodeSize(node);
+                for (size_t i = 0; i < size; ++i) {
+                    const auto & rep = node->reps_[i];
+                    if (IsPacked(rep)) {
+                        next.emplace_back(OffsetToMemNode(Unpack(rep)));
+                    }
+                }
+            }
+            if (next.empty()) {
+                break;
+            }
+            tasks.swap(next);
+        }
+        if (num_threads <= 1 || tasks.front() == root) {
+            return Rebuild(dst, ctx);
+        }
 
-        Page l = RebuildInternalNode(node, cbegin, cend, min_it, pyramid, false, dst, pool);
-        Page r = RebuildInternalNode(node, cbegin, cend, min_it, pyramid, true, dst, pool);
-        return RebuildLRPagesToTree(std::move(l), std::move(r), min_val, dst, pool);
+        // 各线程的 Page 在顶层拼接完成前须保持有效
+        std::mutex alloc_mutex;
+        std::vector<RebuildContext> worker_ctxs(num_threads);
+        std::vector<Page *> pages(tasks.size());
+        std::atomic<size_t> cursor(0);
+        std::exception_ptr error;
+        auto work = [&](RebuildContext * worker_ctx) {
+            worker_ctx->alloc_mutex = &alloc_mutex;
+            size_t i;
+            while ((i = cursor.fetch_add(1, std::memory_order_relaxed)) < tasks.size()) {
+                try {
+                    pages[i] = RebuildSubtree(tasks[i], dst, worker_ctx);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(alloc_mutex);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                    cursor.store(tasks.size(), std::memory_order_relaxed);
+                }
+            }
+        };
+        std::vector<std::thread> workers;
+        workers.reserve(num_threads - 1);
+        for (size_t i = 1; i < num_threads; ++i) {
+            workers.emplace_back(work, &worker_ctxs[i]);
+        }
+        work(&worker_ctxs[0]);
+        for (auto & worker:workers) {
+            worker.join();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+
+        std::unordered_map<const Node *, Page *> built;
+        built.reserve(tasks.size());
+        for (size_t i = 0; i < tasks.size(); ++i) {
+            built.emplace(tasks[i], pages[i]);
+        }
+        ctx->Reset();
+        ctx->built = &built;
+        RebuildPageToNode(*RebuildSubtree(root, dst, ctx),
+                          dst->OffsetToMemNode(dst->kRootOffset));
     }
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
-    typename SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::Page
-    SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
-    RebuildInternalNode(const Node * node,
-                        const K_DIFF * cbegin, const K_DIFF * cend, const K_DIFF * min_it,
-                        typename Node::Pyramid & pyramid, bool direct, SignatureTreeTpl * dst,
-                        std::vector<Page> * pool) const {
-        assert(min_it == std::min_element(cbegin, cend));
-
-        auto make_page = [](std::vector<Page> * p, KV_REP rep) {
-            if (p->empty()) {
-                return Page{{},
-                            {{rep}}};
-            } else {
-                Page page = std::move(p->back());
-                p->pop_back();
-                page.diffs.clear();
-                page.reps = {rep};
-                return page;
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    typename SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::Page *
+    SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    RebuildSubtree(const Node * node, SignatureTreeTpl * dst, RebuildContext * ctx) const {
+        assert(ctx->stack.empty());
+        if (SGT_UNLIKELY(NodeSize(node) == 0)) {
+            Page * page = ctx->NewPage({});
+            page->size = 0;
+            return page;
+        }
+
+        // 子树的 diff 都大于其两侧父节点中的 diff, 展开后的笛卡尔树与原树的嵌套结构一致
+        Page * pending = nullptr; // 最近的 rep, 等待其右侧的 diff
+        auto & path = ctx->path;
+        path.clear();
+        path.emplace_back(node, 0);
+        while (!path.empty()) {
+            const Node * cursor = path.back().first;
+            size_t idx = path.back().second++;
+            if (idx == NodeSize(cursor)) {
+                path.pop_back();
+                continue;
+            }
+            if (idx != 0) {
+                RebuildPushPage(pending, cursor->diffs_[idx - 1], dst, ctx);
             }
-        };
 
-        K_DIFF min_val;
-        if (!direct) { // go left
-            cend = min_it;
-            if (cbegin == cend) {
-                const auto & rep = node->reps_[cend - node->diffs_.cbegin()];
-                return IsPacked(rep) ? RebuildHeadNode(OffsetToMemNode(Unpack(rep)), dst, pool)
-                                     : make_page(pool, rep);
+            const auto & rep = cursor->reps_[idx];
+            if (!IsPacked(rep)) {
+                pending = ctx->NewPage(rep);
+                continue;
             }
-            min_it = node->diffs_.cbegin() + pyramid.TrimRight(node->diffs_.cbegin(), cbegin, cend, &min_val);
-        } else { // go right
-            cbegin = min_it + 1;
-            if (cbegin == cend) {
-                const auto & rep = node->reps_[cend - node->diffs_.cbegin()];
-                return IsPacked(rep) ? RebuildHeadNode(OffsetToMemNode(Unpack(rep)), dst, pool)
-                                     : make_page(pool, rep);
+            const Node * child = OffsetToMemNode(Unpack(rep));
+            if (ctx->built != nullptr) {
+                auto it = ctx->built->find(child);
+                if (it != ctx->built->cend()) {
+                    pending = it->second;
+                    continue;
+                }
             }
-            min_it = node->diffs_.cbegin() + pyramid.TrimLeft(node->diffs_.cbegin(), cbegin, cend, &min_val);
+            assert(NodeSize(child) != 0);
+            path.emplace_back(child, 0);
         }
+        return RebuildPopPages(pending, dst, ctx);
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    RebuildPushPage(Page * page, K_DIFF diff, SignatureTreeTpl * dst,
+                    RebuildContext * ctx, size_t capacity) {
+        auto & stack = ctx->stack;
+        while (!stack.empty() && stack.back().second > diff) {
+            page = RebuildLRPagesToTree(stack.back().first, page, stack.back().second, dst, ctx, capacity);
+            stack.pop_back();
+        }
+        stack.emplace_back(page, diff);
+    }
 
-        Page l = RebuildInternalNode(node, cbegin, cend, min_it, pyramid, false, dst, pool);
-        Page r = RebuildInternalNode(node, cbegin, cend, min_it, pyramid, true, dst, pool);
-        return RebuildLRPagesToTree(std::move(l), std::move(r), min_val, dst, pool);
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    typename SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::Page *
+    SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    RebuildPopPages(Page * page, SignatureTreeTpl * dst,
+                    RebuildContext * ctx, size_t capacity) {
+        auto & stack = ctx->stack;
+        while (!stack.empty()) {
+            page = RebuildLRPagesToTree(stack.back().first, page, stack.back().second, dst, ctx, capacity);
+            stack.pop_back();
+        }
+        return page;
     }
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
-    typename SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::Page
-    SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
-    RebuildLRPagesToTree(Page && l, Page && r, K_DIFF diff, SignatureTreeTpl * dst,
-                         std::vector<Page> * pool) {
-        if (l.reps.size() + r.reps.size() <= kNodeRepRank) {
-            l.diffs.emplace_back(diff);
-            l.diffs.insert(l.diffs.end(), r.diffs.begin(), r.diffs.end());
-            l.reps.insert(l.reps.end(), r.reps.begin(), r.reps.end());
-            pool->emplace_back(std::move(r));
-            return std::move(l);
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    typename SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::Page *
+    SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    RebuildLRPagesToTree(Page * l, Page * r, K_DIFF diff, SignatureTreeTpl * dst,
+                         RebuildContext * ctx, size_t capacity) {
+        assert(l->size != 0 && r->size != 0);
+        if (l->size + r->size <= capacity) {
+            l->diffs[l->size - 1] = diff;
+            std::copy(r->diffs.cbegin(), r->diffs.cbegin() + (r->size - 1), l->diffs.begin() + l->size);
+            std::copy(r->reps.cbegin(), r->reps.cbegin() + r->size, l->reps.begin() + l->size);
+#ifdef SGT_SUBTREE_COUNT
+            std::copy(r->counts.cbegin(), r->counts.cbegin() + r->size, l->counts.begin() + l->size);
+#endif
+            l->size += r->size;
+            ctx->Recycle(r);
+            return l;
+        }
+
+        const auto acceptable = static_cast<size_t>(capacity * 0.625);
+        if (std::min(l->size, r->size) >= acceptable) {
+            KV_REP l_rep = dst->Pack(RebuildPageToTree(*l, dst, ctx->alloc_mutex));
+            KV_REP r_rep = dst->Pack(RebuildPageToTree(*r, dst, ctx->alloc_mutex));
+            l->reps[0] = l_rep;
+            l->reps[1] = r_rep;
+#ifdef SGT_SUBTREE_COUNT
+            uint32_t l_count = PageCount(*l);
+            uint32_t r_count = PageCount(*r);
+            l->counts[0] = l_count;
+            l->counts[1] = r_count;
+#endif
+            l->diffs[0] = diff;
+            l->size = 2;
+            ctx->Recycle(r);
+            return l;
+        }
+        // 较小一侧的 size 小于 acceptable, 加一后仍不超过容量
+        if (l->size <= r->size) {
+            l->diffs[l->size - 1] = diff;
+            l->reps[l->size] = dst->Pack(RebuildPageToTree(*r, dst, ctx->alloc_mutex));
+#ifdef SGT_SUBTREE_COUNT
+            l->counts[l->size] = PageCount(*r);
+#endif
+            ++l->size;
+            ctx->Recycle(r);
+            return l;
         } else {
-            constexpr uint64_t kAcceptable = kNodeRepRank * 0.625;
-            if (std::min(l.reps.size(), r.reps.size()) >= kAcceptable) {
-                l.reps = {dst->Pack(RebuildPageToTree(l, dst)),
-                          dst->Pack(RebuildPageToTree(r, dst))};
-                l.diffs = {diff};
-                pool->emplace_back(std::move(r));
-                return std::move(l);
+            KV_REP l_rep = dst->Pack(RebuildPageToTree(*l, dst, ctx->alloc_mutex));
+            std::copy_backward(r->diffs.cbegin(), r->diffs.cbegin() + (r->size - 1),
+                               r->diffs.begin() + r->size);
+            std::copy_backward(r->reps.cbegin(), r->reps.cbegin() + r->size,
+                               r->reps.begin() + r->size + 1);
+            r->diffs[0] = diff;
+            r->reps[0] = l_rep;
+#ifdef SGT_SUBTREE_COUNT
+            std::copy_backward(r->counts.cbegin(), r->counts.cbegin() + r->size,
+                               r->counts.begin() + r->size + 1);
+            r->counts[0] = PageCount(*l);
+#endif
+            ++r->size;
+            ctx->Recycle(l);
+            return r;
+        }
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    template<typename NEXT>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    BulkLoad(NEXT && next, double fill_factor) {
+        Node * root = OffsetToMemNode(kRootOffset);
+        assert(NodeSize(root) == 0);
+        const size_t capacity = std::clamp(static_cast<size_t>(kNodeRepRank * fill_factor),
+                                           static_cast<size_t>(2), static_cast<size_t>(kNodeRepRank));
+
+        // 相邻 Key 的 diff 序列与各 rep 交错即为中序遍历, 最小的 diff 是根
+        RebuildContext ctx;
+
+        Slice k;
+        KV_REP rep;
+        if (!next(&k, &rep)) {
+            return;
+        }
+        std::string prev = k.ToString();
+        KV_REP prev_rep = rep;
+        while (next(&k, &rep)) {
+            assert(k.size() < kMaxKeyLength);
+            auto byte_at = [](const Slice & s, size_t i) {
+                return i < s.size() ? CharToUint8(s[i]) : static_cast<uint8_t>(0);
+            };
+            size_t end = std::max(prev.size(), k.size());
+            K_DIFF diff_at = 0;
+            while (diff_at < end && byte_at(prev, diff_at) == byte_at(k, diff_at)) {
+                ++diff_at;
             }
-            if (l.reps.size() <= r.reps.size()) {
-                l.diffs.emplace_back(diff);
-                l.reps.emplace_back(dst->Pack(RebuildPageToTree(r, dst)));
-                pool->emplace_back(std::move(r));
-                return std::move(l);
-            } else {
-                r.diffs.insert(r.diffs.begin(), diff);
-                r.reps.insert(r.reps.begin(), dst->Pack(RebuildPageToTree(l, dst)));
-                pool->emplace_back(std::move(l));
-                return std::move(r);
+            if (diff_at == end) { // 重复的 Key, SGT 亦无法区分仅差末尾 '\0' 的 Key, 保留第一个
+                continue;
             }
+            uint8_t a = byte_at(prev, diff_at);
+            uint8_t b = byte_at(k, diff_at);
+            uint8_t shift = (__builtin_clz(a ^ b) ^ 31);
+            assert(((b >> shift) & 1) == 1); // 升序
+
+            K_DIFF packed_diff = PackDiffAtAndShift(diff_at, shift);
+            RebuildPushPage(ctx.NewPage(prev_rep), packed_diff, this, &ctx, capacity);
+            prev.assign(k.data(), k.size());
+            prev_rep = rep;
         }
+
+        RebuildPageToNode(*RebuildPopPages(ctx.NewPage(prev_rep), this, &ctx, capacity), root);
     }
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
-    size_t SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
-    RebuildPageToTree(const Page & page, SignatureTreeTpl * dst) {
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    size_t SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    RebuildPageToTree(const Page & page, SignatureTreeTpl * dst, std::mutex * alloc_mutex) {
         size_t offset;
-        try {
-            offset = dst->allocator_->AllocatePage();
-        } catch (const AllocatorFullException &) {
-            dst->allocator_->Grow();
-            dst->base_ = dst->allocator_->Base();
-            offset = dst->allocator_->AllocatePage();
+        {
+            std::unique_lock<std::mutex> lock;
+            if (alloc_mutex != nullptr) {
+                lock = std::unique_lock<std::mutex>(*alloc_mutex);
+            }
+            try {
+                offset = dst->allocator_->AllocatePage();
+            } catch (const AllocatorFullException &) {
+                dst->allocator_->Grow();
+                // 其他线程可能正在写入已分配的页
+                assert(alloc_mutex == nullptr || dst->allocator_->Base() == dst->base_);
+                dst->base_ = dst->allocator_->Base();
+                offset = dst->allocator_->AllocatePage();
+            }
         }
         Node * node = new(dst->OffsetToMemNode(offset)) Node();
+#ifdef SGT_COPY_ON_WRITE
+        node->gen_ = dst->CurrentGen();
+#endif
         RebuildPageToNode(page, node);
         return offset;
     }
 
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
-    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
     RebuildPageToNode(const Page & page, Node * node) {
-        std::copy(page.reps.cbegin(), page.reps.cend(), node->reps_.begin());
-        std::copy(page.diffs.cbegin(), page.diffs.cend(), node->diffs_.begin());
-        node->size_ = static_cast<uint32_t>(page.reps.size());
-        NodeBuild(node);
+        std::copy(page.reps.cbegin(), page.reps.cbegin() + page.size, node->reps_.begin());
+#ifdef SGT_SUBTREE_COUNT
+        std::copy(page.counts.cbegin(), page.counts.cbegin() + page.size, node->counts_.begin());
+#endif
+        node->size_ = static_cast<uint32_t>(page.size);
+        if (page.size != 0) { // 空树 Rebuild 得到空的 root
+            std::copy(page.diffs.cbegin(), page.diffs.cbegin() + (page.size - 1), node->diffs_.begin());
+            NodeBuild(node);
+        }
     }
 }
 
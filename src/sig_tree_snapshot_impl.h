@@ -0,0 +1,148 @@
+#pragma once
+#ifndef SIG_TREE_SIG_TREE_SNAPSHOT_IMPL_H
+#define SIG_TREE_SIG_TREE_SNAPSHOT_IMPL_H
+
+#ifdef SGT_COPY_ON_WRITE
+
+#include <algorithm>
+
+#include "sig_tree.h"
+
+namespace sgt {
+    /*
+     * 快照持有 root 的副本, 其下的 Node 与树共享
+     * 树的写操作不会修改被共享的 Node, 故快照上的读无需与写同步
+     */
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    class SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::Snapshot {
+    private:
+        SignatureTreeTpl * const tree_;
+        const uint32_t gen_;
+        const SignatureTreeTpl view_;
+
+    public:
+        Snapshot(SignatureTreeTpl * tree, uint32_t gen, size_t root_offset)
+                : tree_(tree),
+                  gen_(gen),
+                  view_(tree->helper_, tree->allocator_, root_offset) {}
+
+        ~Snapshot() { tree_->ReleaseSnapshot(gen_, view_.RootOffset()); }
+
+        Snapshot(const Snapshot &) = delete;
+
+        Snapshot & operator=(const Snapshot &) = delete;
+
+    public:
+        bool Get(const Slice & k, std::string * v) const {
+            return view_.Get(k, v);
+        }
+
+        size_t Size() const {
+            return view_.Size();
+        }
+
+        // bool(* visitor)(const KV_REP & rep)
+        template<bool BACKWARD, typename VISITOR, typename E = std::false_type>
+        void Visit(const Slice & target, VISITOR && visitor, E && expected = {}) const {
+            view_.template Visit<BACKWARD>(target, std::forward<VISITOR>(visitor), std::forward<E>(expected));
+        }
+    };
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    std::unique_ptr<typename SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::Snapshot>
+    SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    GetSnapshot() {
+        size_t offset;
+        try {
+            offset = allocator_->AllocatePage();
+        } catch (const AllocatorFullException &) {
+            allocator_->Grow();
+            assert(allocator_->Base() == base_);
+            offset = allocator_->AllocatePage();
+        }
+
+        Node * root = OffsetToMemNode(kRootOffset);
+        Node * copy = new(OffsetToMemNode(offset)) Node();
+        copy->reps_ = root->reps_;
+        copy->diffs_ = root->diffs_;
+#ifdef SGT_SUBTREE_COUNT
+        copy->counts_ = root->counts_;
+#endif
+        copy->size_ = root->size_;
+        copy->gen_ = root->gen_;
+        copy->pyramid_ = root->pyramid_;
+
+        // 版本号 <= gen 的 Node 此后被快照共享
+        uint32_t gen = root->gen_++;
+        snapshots_.emplace(gen);
+        return std::make_unique<Snapshot>(this, gen, offset);
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    typename SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::Node *
+    SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    NodeCopyIfShared(Node * parent, size_t rep_idx) {
+        auto & rep = parent->reps_[rep_idx];
+        Node * child = OffsetToMemNode(Unpack(rep));
+        if (!IsNodeShared(child)) {
+            return child;
+        }
+
+        size_t offset;
+        try {
+            offset = allocator_->AllocatePage();
+        } catch (const AllocatorFullException &) {
+            allocator_->Grow();
+            assert(allocator_->Base() == base_);
+            offset = allocator_->AllocatePage();
+        }
+
+        // 逐项复制, 不读取快照读者可能正在填写的 cache_
+        Node * copy = new(OffsetToMemNode(offset)) Node();
+        copy->reps_ = child->reps_;
+        copy->diffs_ = child->diffs_;
+#ifdef SGT_SUBTREE_COUNT
+        copy->counts_ = child->counts_;
+#endif
+        copy->size_ = child->size_;
+        copy->gen_ = CurrentGen();
+        copy->pyramid_ = child->pyramid_;
+
+        retired_.emplace_back(Unpack(rep), child->gen_, CurrentGen());
+        rep = Pack(offset);
+        return copy;
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    NodeFree(size_t offset) {
+        const Node * node = OffsetToMemNode(offset);
+        if (IsNodeShared(node)) {
+            retired_.emplace_back(offset, node->gen_, CurrentGen());
+        } else {
+            allocator_->FreePage(offset);
+        }
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    ReleaseSnapshot(uint32_t gen, size_t root_offset) {
+        snapshots_.erase(gen);
+        allocator_->FreePage(root_offset);
+
+        // 版本号在 [born, died) 内的快照都能看到该页
+        retired_.erase(std::remove_if(retired_.begin(), retired_.end(), [this](const auto & retired) {
+            auto[offset, born, died] = retired;
+            auto it = snapshots_.lower_bound(born);
+            if (it == snapshots_.cend() || *it >= died) {
+                allocator_->FreePage(offset);
+                return true;
+            }
+            return false;
+        }), retired_.end());
+    }
+}
+
+#endif
+
+#endif //SIG_TREE_SIG_TREE_SNAPSHOT_IMPL_H
@@ -7,193 +7,236 @@
 #include "sig_tree.h"
 
 namespace sgt {
-    template<typename KV_TRANS, typename K_DIFF, typename KV_REP>
-    template<typename T, bool BACKWARD, typename VISITOR, typename E>
-    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP>::
-    VisitGenericImpl(T self, const Slice & target, VISITOR && visitor, E && expected) {
-        Node * cursor = self->OffsetToMemNode(self->kRootOffset);
-        if (SGT_UNLIKELY(NodeSize(cursor) == 0)) {
-            return;
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    PathLeftmost(Path * que, Node * cursor) const {
+        while (true) {
+            que->emplace_back(cursor, 0);
+            const auto & rep = cursor->reps_[0];
+            if (IsPacked(rep)) {
+                cursor = OffsetToMemNode(Unpack(rep));
+            } else {
+                break;
+            }
         }
-        rocksdb::autovector<std::pair<Node *, size_t /* rep_idx */>, 16> que;
+    }
 
-        [[maybe_unused]] auto leftmost = [self, &que](Node * cursor) {
-            while (true) {
-                que.emplace_back(cursor, 0);
-                const auto & rep = cursor->reps_[0];
-                if (self->IsPacked(rep)) {
-                    cursor = self->OffsetToMemNode(self->Unpack(rep));
-                } else {
-                    break;
-                }
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    PathRightmost(Path * que, Node * cursor) const {
+        while (true) {
+            size_t rep_idx = NodeSize(cursor) - 1;
+            que->emplace_back(cursor, rep_idx);
+            const auto & rep = cursor->reps_[rep_idx];
+            if (IsPacked(rep)) {
+                cursor = OffsetToMemNode(Unpack(rep));
+            } else {
+                break;
             }
-        };
+        }
+    }
 
-        [[maybe_unused]] auto next = [self, &que, &leftmost]() {
-            while (!que.empty()) {
-                auto & p = que.back();
-                if (++p.second < NodeSize(p.first)) {
-                    const auto & rep = p.first->reps_[p.second];
-                    if (self->IsPacked(rep)) {
-                        leftmost(self->OffsetToMemNode(self->Unpack(rep)));
-                    }
-                    break;
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    PathNext(Path * que) const {
+        while (!que->empty()) {
+            auto & p = que->back();
+            if (++p.second < NodeSize(p.first)) {
+                const auto & rep = p.first->reps_[p.second];
+                if (IsPacked(rep)) {
+                    PathLeftmost(que, OffsetToMemNode(Unpack(rep)));
                 }
-                que.pop_back();
+                break;
             }
-        };
+            que->pop_back();
+        }
+    }
 
-        [[maybe_unused]] auto rightmost = [self, &que](Node * cursor) {
-            while (true) {
-                size_t rep_idx = NodeSize(cursor) - 1;
-                que.emplace_back(cursor, rep_idx);
-                const auto & rep = cursor->reps_[rep_idx];
-                if (self->IsPacked(rep)) {
-                    cursor = self->OffsetToMemNode(self->Unpack(rep));
-                } else {
-                    break;
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    PathPrev(Path * que) const {
+        while (!que->empty()) {
+            auto & p = que->back();
+            if (p.second != 0) {
+                --p.second;
+                const auto & rep = p.first->reps_[p.second];
+                if (IsPacked(rep)) {
+                    PathRightmost(que, OffsetToMemNode(Unpack(rep)));
                 }
+                break;
             }
-        };
+            que->pop_back();
+        }
+    }
 
-        [[maybe_unused]] auto prev = [self, &que, &rightmost]() {
-            while (!que.empty()) {
-                auto & p = que.back();
-                if (p.second != 0) {
-                    --p.second;
-                    const auto & rep = p.first->reps_[p.second];
-                    if (self->IsPacked(rep)) {
-                        rightmost(self->OffsetToMemNode(self->Unpack(rep)));
-                    }
-                    break;
-                }
-                que.pop_back();
-            }
-        };
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    template<typename E>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    PathSeek(Path * que, const Slice & target, E && expected) const {
+        Node * cursor = OffsetToMemNode(kRootOffset);
+        if (SGT_UNLIKELY(NodeSize(cursor) == 0)) {
+            return;
+        }
+        while (true) {
+            auto[idx, direct, _] = FindBestMatch(cursor, target);
+            size_t rep_idx = idx + direct;
+            que->emplace_back(cursor, rep_idx);
 
-        if (target.size() == 0) {
-            if constexpr (!BACKWARD) {
-                leftmost(cursor);
+            const auto & rep = cursor->reps_[rep_idx];
+            if (IsPacked(rep)) {
+                cursor = OffsetToMemNode(Unpack(rep));
             } else {
-                rightmost(cursor);
+                PathSeekSettle(que, target, idx, direct, std::forward<E>(expected));
+                break;
             }
-        } else { // Seek
-            while (true) {
-                auto[idx, direct, _] = FindBestMatch(cursor, target);
-                size_t rep_idx = idx + direct;
-                que.emplace_back(cursor, rep_idx);
+        }
+    }
 
-                const auto & rep = cursor->reps_[rep_idx];
-                if (self->IsPacked(rep)) {
-                    cursor = self->OffsetToMemNode(self->Unpack(rep));
-                } else {
-                    if constexpr (!std::is_same<E, std::false_type>::value) {
-                        if (expected == rep) {
-                            break;
-                        }
-                    }
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    int SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    PathCompare(const Path & prefix, const Path & leaf) {
+        // 两条路径均始于 root, 对应层 rep_idx 相同则 Node 也相同
+        for (size_t i = 0; i < prefix.size(); ++i) {
+            assert(i < leaf.size() && prefix[i].first == leaf[i].first);
+            if (prefix[i].second != leaf[i].second) {
+                return prefix[i].second < leaf[i].second ? -1 : 1;
+            }
+        }
+        return 0;
+    }
 
-                    const auto & trans = self->helper_->Trans(rep);
-                    if (trans == target) {
-                    } else { // Reseek
-                        que.pop_back();
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    template<typename E>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    PathSeekSettle(Path * que, const Slice & target, size_t idx, bool direct, E && expected) const {
+        Node * cursor = que->back().first;
+        const auto & rep = cursor->reps_[idx + direct];
+        if constexpr (!std::is_same<std::decay_t<E>, std::false_type>::value) {
+            if (expected == rep) {
+                return;
+            }
+        }
 
-                        [self, &que, &next, &leftmost](const Slice & opponent, const Slice & k,
-                                                       Node * hint, size_t hint_idx, bool hint_direct) {
-                            K_DIFF diff_at = 0;
-                            char a, b;
-                            while ((a = opponent[diff_at]) == (b = k[diff_at])) {
-                                ++diff_at;
-                            }
+        const auto & trans = helper_->Trans(rep);
+        if (trans == target) {
+        } else { // Reseek
+            que->pop_back();
 
-                            // __builtin_clz: returns the number of leading 0-bits in x, starting at the
-                            // most significant bit position if x is 0, the result is undefined
-                            uint8_t shift = (__builtin_clz(CharToUint8(a ^ b)) ^ 31);  // bsr
-                            auto direct = ((CharToUint8(b) >> shift) & 1);
+            [this, que](const Slice & opponent, const Slice & k,
+                        Node * hint, size_t hint_idx, bool hint_direct) {
+                K_DIFF diff_at = 0;
+                char a, b;
+                while ((a = opponent[diff_at]) == (b = k[diff_at])) {
+                    ++diff_at;
+                }
 
-                            K_DIFF packed_diff = PackDiffAtAndShift(diff_at, shift);
-                            Node * cursor = hint;
-                            restart:
-                            while (true) {
-                                size_t insert_idx;
-                                bool insert_direct;
+                // __builtin_clz: returns the number of leading 0-bits in x, starting at the
+                // most significant bit position if x is 0, the result is undefined
+                uint8_t shift = (__builtin_clz(CharToUint8(a ^ b)) ^ 31);  // bsr
+                auto direct = ((CharToUint8(b) >> shift) & 1);
 
-                                size_t cursor_size = NodeSize(cursor);
-                                if (cursor_size == 1 || (hint != nullptr && packed_diff > hint->diffs_[hint_idx])) {
-                                    insert_idx = hint_idx;
-                                    insert_direct = hint_direct;
-                                    assert(!self->IsPacked(cursor->reps_[insert_idx + insert_direct]));
-                                } else {
-                                    const K_DIFF * cbegin = cursor->diffs_.cbegin();
-                                    const K_DIFF * cend = &cursor->diffs_[cursor_size - 1];
+                K_DIFF packed_diff = PackDiffAtAndShift(diff_at, shift);
+                Node * cursor = hint;
+                restart:
+                while (true) {
+                    size_t insert_idx;
+                    bool insert_direct;
 
-                                    K_DIFF exist_diff;
-                                    auto pyramid = cursor->pyramid_;
-                                    const K_DIFF * min_it = cbegin + cursor->pyramid_.MinAt(cbegin, cend, &exist_diff);
-                                    while (true) {
-                                        assert(min_it == std::min_element(cbegin, cend) && *min_it == exist_diff);
-                                        if (exist_diff > packed_diff) {
-                                            if (hint != nullptr) {
-                                                hint = nullptr;
-                                                cursor = self->OffsetToMemNode(self->kRootOffset);
-                                                que.clear();
-                                                goto restart;
-                                            }
-                                            insert_idx = (!direct ? cbegin : (cend - 1)) - cursor->diffs_.cbegin();
-                                            insert_direct = direct;
-                                            break;
-                                        }
-                                        hint = nullptr;
+                    size_t cursor_size = NodeSize(cursor);
+                    if (cursor_size == 1 || (hint != nullptr && packed_diff > hint->diffs_[hint_idx])) {
+                        insert_idx = hint_idx;
+                        insert_direct = hint_direct;
+                        assert(!IsPacked(cursor->reps_[insert_idx + insert_direct]));
+                    } else {
+                        const K_DIFF * cbegin = cursor->diffs_.cbegin();
+                        const K_DIFF * cend = &cursor->diffs_[cursor_size - 1];
 
-                                        auto[crit_diff_at, crit_shift] = UnpackDiffAtAndShift(exist_diff);
-                                        uint8_t crit_byte = k.size() > crit_diff_at
-                                                            ? CharToUint8(k[crit_diff_at])
-                                                            : static_cast<uint8_t>(0);
-                                        auto crit_direct = ((crit_byte >> crit_shift) & 1);
-                                        if (!crit_direct) {
-                                            cend = min_it;
-                                            if (cbegin == cend) {
-                                                insert_idx = min_it - cursor->diffs_.cbegin();
-                                                insert_direct = crit_direct;
-                                                break;
-                                            }
-                                            min_it = cursor->diffs_.cbegin() +
-                                                     pyramid.TrimRight(cursor->diffs_.cbegin(), cbegin, cend,
-                                                                       &exist_diff);
-                                        } else {
-                                            cbegin = min_it + 1;
-                                            if (cbegin == cend) {
-                                                insert_idx = min_it - cursor->diffs_.cbegin();
-                                                insert_direct = crit_direct;
-                                                break;
-                                            }
-                                            min_it = cursor->diffs_.cbegin() +
-                                                     pyramid.TrimLeft(cursor->diffs_.cbegin(), cbegin, cend,
-                                                                      &exist_diff);
-                                        }
-                                    }
+                        K_DIFF exist_diff;
+                        auto pyramid = cursor->pyramid_;
+                        const K_DIFF * min_it = cbegin + cursor->pyramid_.MinAt(cbegin, cend, &exist_diff);
+                        while (true) {
+                            assert(min_it == std::min_element(cbegin, cend) && *min_it == exist_diff);
+                            if (exist_diff > packed_diff) {
+                                if (hint != nullptr) {
+                                    hint = nullptr;
+                                    cursor = OffsetToMemNode(kRootOffset);
+                                    que->clear();
+                                    goto restart;
                                 }
+                                insert_idx = (!direct ? cbegin : (cend - 1)) - cursor->diffs_.cbegin();
+                                insert_direct = direct;
+                                break;
+                            }
+                            hint = nullptr;
 
-                                size_t rep_idx = insert_idx + insert_direct;
-                                que.emplace_back(cursor, rep_idx);
-
-                                const auto & rep = cursor->reps_[rep_idx];
-                                if (cursor->diffs_[insert_idx] > packed_diff || !self->IsPacked(rep)) {
-                                    if (direct) {
-                                        next();
-                                    } else if (self->IsPacked(rep)) {
-                                        leftmost(self->OffsetToMemNode(self->Unpack(rep)));
-                                    }
+                            auto[crit_diff_at, crit_shift] = UnpackDiffAtAndShift(exist_diff);
+                            uint8_t crit_byte = k.size() > crit_diff_at
+                                                ? CharToUint8(k[crit_diff_at])
+                                                : static_cast<uint8_t>(0);
+                            auto crit_direct = ((crit_byte >> crit_shift) & 1);
+                            if (!crit_direct) {
+                                cend = min_it;
+                                if (cbegin == cend) {
+                                    insert_idx = min_it - cursor->diffs_.cbegin();
+                                    insert_direct = crit_direct;
                                     break;
                                 }
-                                cursor = self->OffsetToMemNode(self->Unpack(rep));
+                                min_it = cursor->diffs_.cbegin() +
+                                         pyramid.TrimRight(cursor->diffs_.cbegin(), cbegin, cend,
+                                                           &exist_diff);
+                            } else {
+                                cbegin = min_it + 1;
+                                if (cbegin == cend) {
+                                    insert_idx = min_it - cursor->diffs_.cbegin();
+                                    insert_direct = crit_direct;
+                                    break;
+                                }
+                                min_it = cursor->diffs_.cbegin() +
+                                         pyramid.TrimLeft(cursor->diffs_.cbegin(), cbegin, cend,
+                                                          &exist_diff);
                             }
-                        }(trans.Key(), target, cursor, idx, direct);
+                        }
+                    }
 
+                    size_t rep_idx = insert_idx + insert_direct;
+                    que->emplace_back(cursor, rep_idx);
+
+                    const auto & rep = cursor->reps_[rep_idx];
+                    if (cursor->diffs_[insert_idx] > packed_diff || !IsPacked(rep)) {
+                        if (direct) {
+                            PathNext(que);
+                        } else if (IsPacked(rep)) {
+                            PathLeftmost(que, OffsetToMemNode(Unpack(rep)));
+                        }
+                        break;
                     }
-                    break;
+                    cursor = OffsetToMemNode(Unpack(rep));
                 }
+            }(trans.Key(), target, cursor, idx, direct);
+        }
+    }
+
+    template<typename KV_TRANS, typename K_DIFF, typename KV_REP, typename NODE_POLICY>
+    template<typename T, bool BACKWARD, typename VISITOR, typename E>
+    void SignatureTreeTpl<KV_TRANS, K_DIFF, KV_REP, NODE_POLICY>::
+    VisitGenericImpl(T self, const Slice & target, VISITOR && visitor, E && expected) {
+        Node * cursor = self->OffsetToMemNode(self->kRootOffset);
+        if (SGT_UNLIKELY(NodeSize(cursor) == 0)) {
+            return;
+        }
+        Path que;
+        auto next = [self, &que]() { self->PathNext(&que); };
+        auto prev = [self, &que]() { self->PathPrev(&que); };
+        auto leftmost = [self, &que](Node * cursor) { self->PathLeftmost(&que, cursor); };
+
+        if (target.size() == 0) {
+            if constexpr (!BACKWARD) {
+                leftmost(cursor);
+            } else {
+                self->PathRightmost(&que, cursor);
             }
+        } else {
+            self->PathSeek(&que, target, std::forward<E>(expected));
         }
 
         if constexpr (std::is_same<T, const SignatureTreeTpl *>::value) {
@@ -210,7 +253,14 @@ namespace sgt {
                 }
             }
         } else { // del
+            self->MarkModified();
             while (!que.empty()) {
+#ifdef SGT_COPY_ON_WRITE
+                // visitor 可改写 rep, 先复制整条路径上被快照共享的 Node
+                for (size_t i = 1; i < que.size(); ++i) {
+                    que[i].first = self->NodeCopyIfShared(que[i - 1].first, que[i - 1].second);
+                }
+#endif
                 auto it = que.end();
                 auto[node, rep_idx] = *(--it);
                 auto[proceed, del] = visitor(node->reps_[rep_idx]);
@@ -228,6 +278,11 @@ namespace sgt {
                         size_t size = NodeSize(node);
                         bool direct = !(rep_idx == 0 || (rep_idx != size - 1
                                                          && node->diffs_[rep_idx - 1] < node->diffs_[rep_idx]));
+#ifdef SGT_SUBTREE_COUNT
+                        for (size_t i = 0; i + 1 < que.size(); ++i) {
+                            --que[i].first->counts_[que[i].second];
+                        }
+#endif
 
                         NodeRemove(node, rep_idx - direct, direct, size--);
                         if (parent != nullptr && parent->reps_.size() - parent_size + 1 >= size) {
@@ -0,0 +1,224 @@
+#pragma once
+#ifndef SIG_TREE_WAL_H
+#define SIG_TREE_WAL_H
+
+/*
+ * 操作级重做日志
+ *
+ * 记录格式: checksum(4) | lsn(8) | type(1) | k_size(4) | v_size(4) | k | v
+ * 末尾校验失败的记录视为崩溃时未写完, 恢复时截断
+ *
+ * 组提交: Append 只写入内存缓冲, Sync(lsn) 由一个线程 (leader) 将缓冲一次写出并 fdatasync
+ * 其余等待同一批的线程 (follower) 直接返回, 多次 Add/Del 共享一次 fsync
+ *
+ * 写出或 fdatasync 失败后日志进入失败状态, 此后 Append/Sync 均抛出同一错误
+ * fdatasync 失败后内核可能已丢弃脏页, 重试无法保证之前的记录落盘
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <system_error>
+
+#include "slice.h"
+
+namespace sgt {
+    class WriteAheadLog {
+    public:
+        enum : uint8_t {
+            kAdd = 1,
+            kDel = 2
+        };
+
+        enum {
+            kHeaderSize = 4 + 8 + 1 + 4 + 4
+        };
+
+    private:
+        int fd_;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::string buffer_;
+        uint64_t next_lsn_ = 1;
+        uint64_t durable_lsn_ = 0;
+        bool syncing_ = false;
+        int error_ = 0; // 非 0 表示失败状态
+
+    public:
+        explicit WriteAheadLog(const char * path) {
+            fd_ = open(path, O_RDWR | O_CREAT, 0644);
+            if (fd_ < 0) {
+                throw std::system_error(errno, std::generic_category(), path);
+            }
+        }
+
+        ~WriteAheadLog() {
+            close(fd_);
+        }
+
+        WriteAheadLog(const WriteAheadLog &) = delete;
+
+        WriteAheadLog & operator=(const WriteAheadLog &) = delete;
+
+    public:
+        // void(* visitor)(uint8_t type, const Slice & k, const Slice & v)
+        // 回放 lsn > after_lsn 的记录, 截断损坏的尾部, 此后 Append 从最大 lsn 之后继续编号
+        // 须在任何 Append 之前调用
+        template<typename VISITOR>
+        void Replay(uint64_t after_lsn, VISITOR && visitor) {
+            std::string content;
+            char buf[1 << 16];
+            ssize_t n;
+            while ((n = pread(fd_, buf, sizeof(buf), static_cast<off_t>(content.size()))) > 0) {
+                content.append(buf, static_cast<size_t>(n));
+            }
+            if (n < 0) {
+                throw std::system_error(errno, std::generic_category(), "pread");
+            }
+
+            uint64_t last_lsn = after_lsn;
+            size_t pos = 0;
+            while (content.size() - pos >= kHeaderSize) {
+                const char * p = content.data() + pos;
+                uint32_t checksum;
+                uint64_t lsn;
+                uint8_t type;
+                uint32_t k_size;
+                uint32_t v_size;
+                memcpy(&checksum, p, 4);
+                memcpy(&lsn, p + 4, 8);
+                memcpy(&type, p + 12, 1);
+                memcpy(&k_size, p + 13, 4);
+                memcpy(&v_size, p + 17, 4);
+
+                size_t size = kHeaderSize + static_cast<size_t>(k_size) + v_size;
+                if (content.size() - pos < size || Checksum(p + 4, size - 4) != checksum) {
+                    break;
+                }
+                if (lsn > after_lsn) {
+                    visitor(type, Slice(p + kHeaderSize, k_size), Slice(p + kHeaderSize + k_size, v_size));
+                    last_lsn = lsn;
+                }
+                pos += size;
+            }
+            if (pos != content.size() && ftruncate(fd_, static_cast<off_t>(pos)) != 0) {
+                throw std::system_error(errno, std::generic_category(), "ftruncate");
+            }
+            next_lsn_ = last_lsn + 1;
+            durable_lsn_ = last_lsn;
+        }
+
+        // 返回该记录的 lsn, 记录在 Sync 之前不保证持久
+        uint64_t Append(uint8_t type, const Slice & k, const Slice & v) {
+            auto k_size = static_cast<uint32_t>(k.size());
+            auto v_size = static_cast<uint32_t>(v.size());
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            ThrowIfFailed();
+            uint64_t lsn = next_lsn_++;
+            size_t pos = buffer_.size();
+            buffer_.resize(pos + kHeaderSize);
+            char * p = &buffer_[pos];
+            memcpy(p + 4, &lsn, 8);
+            memcpy(p + 12, &type, 1);
+            memcpy(p + 13, &k_size, 4);
+            memcpy(p + 17, &v_size, 4);
+            buffer_.append(k.data(), k.size());
+            buffer_.append(v.data(), v.size());
+
+            uint32_t checksum = Checksum(&buffer_[pos + 4], buffer_.size() - pos - 4);
+            memcpy(&buffer_[pos], &checksum, 4);
+            return lsn;
+        }
+
+        // 阻塞至 lsn 及之前的记录持久化
+        void Sync(uint64_t lsn) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (durable_lsn_ < lsn) {
+                ThrowIfFailed();
+                if (syncing_) { // 已有 leader, 等待其完成后再检查
+                    cv_.wait(lock);
+                    continue;
+                }
+
+                syncing_ = true;
+                std::string batch;
+                batch.swap(buffer_);
+                uint64_t target = next_lsn_ - 1;
+                lock.unlock();
+
+                int err = Write(batch);
+                lock.lock();
+                syncing_ = false;
+                cv_.notify_all();
+                if (err != 0) { // 这一批未能持久化, 不推进 durable_lsn_
+                    error_ = err;
+                    ThrowIfFailed();
+                }
+                durable_lsn_ = target;
+            }
+        }
+
+        void SyncAll() {
+            uint64_t lsn;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                lsn = next_lsn_ - 1;
+            }
+            Sync(lsn);
+        }
+
+        // 检查点已包含全部记录后清空日志, 调用时不得有并发 Append
+        void Reset() {
+            SyncAll();
+            if (ftruncate(fd_, 0) != 0 || fdatasync(fd_) != 0) {
+                throw std::system_error(errno, std::generic_category(), "ftruncate");
+            }
+        }
+
+        uint64_t LastLsn() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return next_lsn_ - 1;
+        }
+
+    private:
+        void ThrowIfFailed() const {
+            if (error_ != 0) {
+                throw std::system_error(error_, std::generic_category(), "wal");
+            }
+        }
+
+        int Write(const std::string & batch) {
+            off_t end = lseek(fd_, 0, SEEK_END);
+            if (end < 0) {
+                return errno;
+            }
+            for (size_t written = 0; written < batch.size();) {
+                ssize_t n = pwrite(fd_, batch.data() + written, batch.size() - written,
+                                   end + static_cast<off_t>(written));
+                if (n < 0) {
+                    return errno;
+                }
+                written += static_cast<size_t>(n);
+            }
+            return fdatasync(fd_) != 0 ? errno : 0;
+        }
+
+        // FNV-1a
+        static uint32_t Checksum(const char * data, size_t size) {
+            uint32_t hash = 2166136261u;
+            for (size_t i = 0; i < size; ++i) {
+                hash = (hash ^ CharToUint8(data[i])) * 16777619u;
+            }
+            return hash;
+        }
+    };
+}
+
+#endif //SIG_TREE_WAL_H
@@ -0,0 +1,223 @@
+#define SGT_SUBTREE_COUNT
+
+#include <iostream>
+#include <random>
+#include <set>
+#include <unordered_set>
+
+#include "../src/sig_tree.h"
+#include "../src/sig_tree_impl.h"
+#include "../src/sig_tree_mop_impl.h"
+#include "../src/sig_tree_node_impl.h"
+#include "../src/sig_tree_range_impl.h"
+#include "../src/sig_tree_rebuild_impl.h"
+#include "../src/sig_tree_visit_impl.h"
+
+#include "sig_tree_test_fixture.h"
+
+namespace sgt::sig_tree_count_test {
+    void Run() {
+        constexpr unsigned int kTestTimes = 10000;
+
+        Helper helper;
+        AllocatorImpl allocator;
+        SignatureTreeTpl<KVTrans> tree(&helper, &allocator);
+
+        struct cmp {
+            bool operator()(uint32_t a, uint32_t b) const {
+                return memcmp(&a, &b, sizeof(uint32_t)) < 0;
+            }
+        };
+        typedef std::set<uint32_t, cmp> Set;
+
+        auto seed = std::random_device()();
+        std::cout << "sig_tree_count_test_seed: " << seed << std::endl;
+
+        std::default_random_engine engine(seed);
+        std::uniform_int_distribution<uint32_t> dist(0, UINT32_MAX >> 1);
+        auto random_key = [&]() {
+            uint32_t v = (dist(engine) << 16) | (dist(engine) % 8);
+            return v + (v % 2 == 0);
+        };
+
+        // Size, 逐个 Select, 以及随机的 Rank/CountRange 均与 std::set 一致
+        auto check = [&](auto & t, const Set & expect) {
+            assert(t.Size() == expect.size());
+            size_t i = 0;
+            for (uint32_t v:expect) {
+                const uint64_t * rep = t.Select(i++);
+                assert(rep != nullptr && v == (*rep >> 32));
+                static_cast<void>(rep);
+                static_cast<void>(v);
+            }
+            assert(t.Select(i) == nullptr);
+
+            for (size_t j = 0; j < 200; ++j) {
+                uint32_t lo = random_key();
+                if (j % 2 == 1 && !expect.empty()) { // 已存在的 Key
+                    auto it = expect.lower_bound(lo);
+                    lo = it != expect.cend() ? *it : *expect.cbegin();
+                }
+                uint32_t hi = random_key();
+                Slice lo_s(reinterpret_cast<char *>(&lo), sizeof(lo));
+                Slice hi_s(reinterpret_cast<char *>(&hi), sizeof(hi));
+                size_t rank = std::distance(expect.cbegin(), expect.lower_bound(lo));
+                assert(t.Rank(lo_s) == rank);
+                size_t count = cmp()(lo, hi) ? std::distance(expect.lower_bound(lo), expect.lower_bound(hi)) : 0;
+                assert(t.CountRange(lo_s, hi_s) == count);
+                assert(t.CountRange(lo_s, {}) == expect.size() - rank);
+                assert(t.EstimateRange(lo_s, hi_s) == count);
+                static_cast<void>(rank);
+                static_cast<void>(count);
+            }
+            assert(t.Rank({}) == 0 && t.CountRange({}, {}) == expect.size());
+
+            // 分位精确: 第 i 个分界为第 floor(i / q × Size()) 小的 rep; 抽样均为已有的 Key
+            constexpr size_t kQ = 8;
+            auto splits = t.Quantiles(kQ);
+            if (expect.size() >= kQ) {
+                assert(splits.size() == kQ - 1);
+                for (size_t j = 0; j < splits.size(); ++j) {
+                    uint32_t v = splits[j] >> 32;
+                    size_t rank = std::distance(expect.cbegin(), expect.find(v));
+                    assert(rank == static_cast<size_t>(static_cast<double>(j + 1) / kQ * expect.size()));
+                    static_cast<void>(rank);
+                }
+            }
+            for (const auto & rep:t.Sample(100, engine)) {
+                assert(expect.count(rep >> 32) == 1);
+                static_cast<void>(rep);
+            }
+            assert(t.Sample(100, engine).size() == (expect.empty() ? 0 : 100));
+        };
+
+        Set set;
+        check(tree, set);
+        for (size_t i = 0; i < kTestTimes; ++i) {
+            uint32_t v = random_key();
+            set.emplace(v);
+            Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+            tree.Add(s, s);
+        }
+        check(tree, set);
+
+        for (size_t i = 0; i < kTestTimes; ++i) {
+            uint32_t v;
+            if (std::bernoulli_distribution()(engine)) {
+                v = random_key();
+                set.emplace(v);
+                Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+                tree.Add(s, s);
+            } else if (!set.empty()) {
+                auto it = set.lower_bound(random_key());
+                if (it == set.end()) {
+                    it = set.begin();
+                }
+                v = *it;
+                set.erase(it);
+                Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+                bool deleted = tree.Del(s);
+                assert(deleted);
+                static_cast<void>(deleted);
+            }
+        }
+        check(tree, set);
+
+        {
+            std::vector<uint32_t> vs;
+            for (size_t i = 0; i < 1000; ++i) {
+                vs.emplace_back(random_key());
+                set.emplace(vs.back());
+            }
+            std::vector<Slice> ss;
+            for (uint32_t & v:vs) {
+                ss.emplace_back(reinterpret_cast<char *>(&v), sizeof(v));
+            }
+            tree.MultiAdd(ss.data(), ss.data(), ss.size());
+            check(tree, set);
+
+            for (size_t i = 0; i < ss.size(); i += 2) {
+                set.erase(vs[i]);
+            }
+            std::vector<Slice> half;
+            for (size_t i = 0; i < ss.size(); i += 2) {
+                half.emplace_back(ss[i]);
+            }
+            tree.MultiDel(half.data(), half.size());
+            check(tree, set);
+        }
+
+        tree.VisitDel<tree.kForward>("", [&](const uint64_t & rep) -> std::pair<bool, bool> {
+            if (std::bernoulli_distribution()(engine)) {
+                set.erase(static_cast<uint32_t>(rep >> 32));
+                return {true, true};
+            }
+            return {true, false};
+        });
+        check(tree, set);
+        tree.Compact();
+        check(tree, set);
+
+        {
+            uint32_t lo = random_key();
+            uint32_t hi = random_key();
+            if (Set::key_compare()(hi, lo)) {
+                std::swap(lo, hi);
+            }
+            set.erase(set.lower_bound(lo), set.lower_bound(hi));
+            tree.DeleteRange(Slice(reinterpret_cast<char *>(&lo), sizeof(lo)),
+                             Slice(reinterpret_cast<char *>(&hi), sizeof(hi)));
+            check(tree, set);
+        }
+
+        for (size_t num_threads:{1, 4}) {
+            Helper dst_helper;
+            AllocatorImpl dst_allocator;
+            SignatureTreeTpl<KVTrans> dst(&dst_helper, &dst_allocator);
+            tree.Rebuild(&dst, num_threads);
+            check(dst, set);
+        }
+        for (double fill_factor:{1.0, 0.5}) {
+            AllocatorImpl bulk_allocator;
+            SignatureTreeTpl<KVTrans> bulk(&helper, &bulk_allocator);
+            auto it = set.cbegin();
+            uint32_t k;
+            bulk.BulkLoad([&](Slice * s, uint64_t * rep) {
+                if (it == set.cend()) {
+                    return false;
+                }
+                k = *it++;
+                *s = {reinterpret_cast<char *>(&k), sizeof(k)};
+                *rep = (static_cast<uint64_t>(k) << 32) | k;
+                return true;
+            }, fill_factor);
+            check(bulk, set);
+
+            // 插入、删除后 NodeSplit/NodeMerge 维护的计数仍然正确
+            Set rest = set;
+            for (size_t i = 0; i < kTestTimes / 4; ++i) {
+                uint32_t v = random_key();
+                rest.emplace(v);
+                Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+                bulk.Add(s, s);
+            }
+            for (auto iter = rest.begin(); iter != rest.end();) {
+                if (std::bernoulli_distribution(0.75)(engine)) {
+                    Slice s(reinterpret_cast<const char *>(&*iter), sizeof(uint32_t));
+                    bulk.Del(s);
+                    iter = rest.erase(iter);
+                } else {
+                    ++iter;
+                }
+            }
+            check(bulk, rest);
+        }
+
+        for (uint32_t v:set) {
+            Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+            tree.Del(s);
+        }
+        assert(allocator.records_.size() == 1);
+        check(tree, {});
+    }
+}
@@ -0,0 +1,150 @@
+#define SGT_COPY_ON_WRITE
+
+#include <iostream>
+#include <random>
+#include <set>
+#include <thread>
+#include <unordered_set>
+
+#include "../src/sig_tree.h"
+#include "../src/sig_tree_impl.h"
+#include "../src/sig_tree_mop_impl.h"
+#include "../src/sig_tree_node_impl.h"
+#include "../src/sig_tree_range_impl.h"
+#include "../src/sig_tree_rebuild_impl.h"
+#include "../src/sig_tree_snapshot_impl.h"
+#include "../src/sig_tree_visit_impl.h"
+
+#include "sig_tree_test_fixture.h"
+
+namespace sgt::sig_tree_cow_test {
+    void Run() {
+        constexpr unsigned int kTestTimes = 10000;
+
+        Helper helper;
+        AllocatorImpl allocator;
+        SignatureTreeTpl<KVTrans> tree(&helper, &allocator);
+
+        struct cmp {
+            bool operator()(uint32_t a, uint32_t b) const {
+                return memcmp(&a, &b, sizeof(uint32_t)) < 0;
+            }
+        };
+        typedef std::set<uint32_t, cmp> Set;
+
+        auto seed = std::random_device()();
+        std::cout << "sig_tree_cow_test_seed: " << seed << std::endl;
+
+        std::default_random_engine engine(seed);
+        std::uniform_int_distribution<uint32_t> dist(0, UINT32_MAX >> 1);
+        auto random_key = [&]() {
+            uint32_t v = (dist(engine) << 16) | (dist(engine) % 8);
+            return v + (v % 2 == 0);
+        };
+
+        auto check = [](const auto & t, const Set & expect) {
+            auto it = expect.cbegin();
+            t.template Visit<SignatureTreeTpl<KVTrans>::kForward>("", [&it](const uint64_t & rep) {
+                uint32_t v = *it++;
+                return v == (rep >> 32);
+            });
+            assert(it == expect.cend());
+            assert(t.Size() == expect.size());
+
+            std::string out;
+            for (uint32_t v:expect) {
+                Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+                bool found = t.Get(s, &out);
+                assert(found && s == out);
+                static_cast<void>(found);
+            }
+        };
+
+        Set set;
+        for (size_t i = 0; i < kTestTimes; ++i) {
+            uint32_t v = random_key();
+            set.emplace(v);
+            Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+            tree.Add(s, s);
+        }
+
+        // 快照上的全量扫描与写入并发进行
+        auto snapshot = tree.GetSnapshot();
+        const Set frozen = set;
+        {
+            std::thread reader([&]() {
+                for (size_t i = 0; i < 4; ++i) {
+                    check(*snapshot, frozen);
+                }
+            });
+            for (size_t i = 0; i < kTestTimes; ++i) {
+                uint32_t v;
+                if (std::bernoulli_distribution()(engine)) {
+                    v = random_key();
+                    set.emplace(v);
+                    Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+                    tree.Add(s, s);
+                } else if (!set.empty()) {
+                    auto it = set.lower_bound(random_key());
+                    if (it == set.end()) {
+                        it = set.begin();
+                    }
+                    v = *it;
+                    set.erase(it);
+                    Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+                    bool deleted = tree.Del(s);
+                    assert(deleted);
+                    static_cast<void>(deleted);
+                }
+            }
+            reader.join();
+        }
+        check(*snapshot, frozen);
+        check(tree, set);
+
+        // 多个快照按任意顺序释放
+        auto another = tree.GetSnapshot();
+        const Set another_frozen = set;
+        tree.VisitDel<tree.kForward>("", [&](const uint64_t & rep) -> std::pair<bool, bool> {
+            if (std::bernoulli_distribution()(engine)) {
+                set.erase(static_cast<uint32_t>(rep >> 32));
+                return {true, true};
+            }
+            return {true, false};
+        });
+        tree.Compact();
+        check(*snapshot, frozen);
+        check(*another, another_frozen);
+        check(tree, set);
+
+        snapshot.reset();
+        check(*another, another_frozen);
+        another.reset();
+        check(tree, set);
+
+        {
+            uint32_t lo = random_key();
+            uint32_t hi = random_key();
+            if (Set::key_compare()(hi, lo)) {
+                std::swap(lo, hi);
+            }
+            auto first = set.lower_bound(lo);
+            auto last = set.lower_bound(hi);
+            size_t expect = std::distance(first, last);
+            set.erase(first, last);
+            size_t deleted = tree.DeleteRange(Slice(reinterpret_cast<char *>(&lo), sizeof(lo)),
+                                              Slice(reinterpret_cast<char *>(&hi), sizeof(hi)));
+            assert(deleted == expect);
+            static_cast<void>(deleted);
+            static_cast<void>(expect);
+            check(tree, set);
+        }
+
+        for (uint32_t v:set) {
+            Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+            tree.Del(s);
+        }
+        assert(allocator.records_.size() == 1);
+        assert(tree.Size() == 0);
+    }
+}
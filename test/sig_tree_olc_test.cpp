@@ -0,0 +1,139 @@
+#define SGT_OPTIMISTIC_LOCK
+
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <set>
+#include <thread>
+#include <unordered_set>
+
+#include "../src/sig_tree.h"
+#include "../src/sig_tree_impl.h"
+#include "../src/sig_tree_mop_impl.h"
+#include "../src/sig_tree_node_impl.h"
+#include "../src/sig_tree_range_impl.h"
+#include "../src/sig_tree_rebuild_impl.h"
+#include "../src/sig_tree_visit_impl.h"
+
+#include "sig_tree_test_fixture.h"
+
+namespace sgt::sig_tree_olc_test {
+    void Run() {
+        {
+            // 活跃读者阻止 epoch 推进, 退役页不会被归还
+            AllocatorImpl allocator;
+            EpochManager epoch(&allocator);
+            constexpr size_t kRetireTimes = EpochManager::kBatchSize * 4;
+            {
+                EpochManager::Guard guard(&epoch);
+                for (size_t i = 0; i < kRetireTimes; ++i) {
+                    epoch.Retire(allocator.AllocatePage());
+                }
+                assert(allocator.records_.size() == kRetireTimes);
+            }
+            for (size_t i = 0; i < EpochManager::kBatchSize; ++i) {
+                epoch.Retire(allocator.AllocatePage());
+            }
+            assert(allocator.records_.size() < kRetireTimes + EpochManager::kBatchSize);
+            epoch.Reclaim();
+            assert(allocator.records_.empty());
+        }
+
+        constexpr unsigned int kWriters = 4;
+        constexpr unsigned int kReaders = 2;
+        constexpr unsigned int kOpTimes = 20000;
+        constexpr uint32_t kKeySpace = 1 << 14;
+
+        Helper helper;
+        AllocatorImpl allocator;
+        SignatureTreeTpl<KVTrans> tree(&helper, &allocator);
+
+        struct cmp {
+            bool operator()(uint32_t a, uint32_t b) const {
+                return memcmp(&a, &b, sizeof(uint32_t)) < 0;
+            }
+        };
+        std::mutex set_mutex;
+        std::set<uint32_t, cmp> set;
+
+        auto seed = std::random_device()();
+        std::cout << "sig_tree_olc_test_seed: " << seed << std::endl;
+
+        // 写者从不触碰的常驻 Key, 与写者的 Key 仅最高字节不同, 在树中相互穿插
+        // 读者查找它们必须总是命中, 乐观读在重试、校验上的错误不会被 "未找到" 掩盖
+        auto stable_key = [](uint32_t x) { return (((x << 1) | 1) << 8 | 1) | (static_cast<uint32_t>(1) << 24); };
+        for (uint32_t x = 0; x < kKeySpace; x += 4) {
+            uint32_t v = stable_key(x);
+            Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+            tree.Add(s, s);
+            set.emplace(v);
+        }
+
+        // 每个写者独占 (key >> 1) % kWriters == t 的 Key, 单 Key 上的操作有序, 结果可与 std::set 逐一比对
+        std::vector<std::thread> threads;
+        for (unsigned int t = 0; t < kWriters; ++t) {
+            threads.emplace_back([&, t]() {
+                std::default_random_engine engine(seed + t);
+                std::uniform_int_distribution<uint32_t> dist(0, kKeySpace / kWriters - 1);
+                for (size_t i = 0; i < kOpTimes; ++i) {
+                    uint32_t v = (((dist(engine) * kWriters + t) << 1) | 1) << 8 | 1;
+                    Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+                    if (std::bernoulli_distribution(0.6)(engine)) {
+                        bool added = tree.Add(s, s);
+                        std::lock_guard<std::mutex> lock(set_mutex);
+                        bool expect = set.emplace(v).second;
+                        assert(added == expect);
+                        static_cast<void>(added);
+                        static_cast<void>(expect);
+                    } else {
+                        bool deleted = tree.Del(s);
+                        std::lock_guard<std::mutex> lock(set_mutex);
+                        bool expect = set.erase(v) == 1;
+                        assert(deleted == expect);
+                        static_cast<void>(deleted);
+                        static_cast<void>(expect);
+                    }
+                }
+            });
+        }
+        for (unsigned int t = 0; t < kReaders; ++t) {
+            threads.emplace_back([&, t]() {
+                std::default_random_engine engine(seed + kWriters + t);
+                std::uniform_int_distribution<uint32_t> dist(0, kKeySpace - 1);
+                std::string out;
+                for (size_t i = 0; i < kOpTimes; ++i) {
+                    uint32_t v = ((dist(engine) << 1) | 1) << 8 | 1;
+                    Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+                    if (tree.Get(s, &out)) {
+                        assert(s == out);
+                    }
+
+                    v = stable_key(dist(engine) & ~static_cast<uint32_t>(3));
+                    bool found = tree.Get(s, &out);
+                    assert(found && s == out);
+                    static_cast<void>(found);
+                }
+            });
+        }
+        for (auto & thread:threads) {
+            thread.join();
+        }
+        tree.ReclaimRetiredPages();
+
+        assert(tree.Size() == set.size());
+        auto it = set.cbegin();
+        tree.Visit<tree.kForward>("", [&it](const uint64_t & rep) {
+            uint32_t v = *it++;
+            return v == (rep >> 32);
+        });
+        assert(it == set.cend());
+
+        std::string out;
+        for (uint32_t v:set) {
+            Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+            bool found = tree.Get(s, &out);
+            assert(found && s == out);
+            static_cast<void>(found);
+        }
+    }
+}
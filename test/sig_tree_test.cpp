@@ -1,117 +1,142 @@
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <mutex>
 #include <random>
 #include <set>
+#include <thread>
 #include <unordered_set>
 
+#include "../src/durable_sig_tree.h"
+#include "../src/hugepage_allocator.h"
+#include "../src/mmap_allocator.h"
+#include "../src/sharded_sig_tree.h"
 #include "../src/sig_tree.h"
 #include "../src/sig_tree_impl.h"
+#include "../src/sig_tree_iterator_impl.h"
+#include "../src/sig_tree_lookup_impl.h"
 #include "../src/sig_tree_mop_impl.h"
 #include "../src/sig_tree_node_impl.h"
+#include "../src/sig_tree_range_impl.h"
 #include "../src/sig_tree_rebuild_impl.h"
 #include "../src/sig_tree_visit_impl.h"
 
-namespace sgt::sig_tree_test {
-    /*
-     * K = uint32_t
-     * V = uint32_t
-     * little-endian REP : uint64_t = (V << 32) | K
-     *
-     * if REP % 2 = 0, then REP is packed
-     */
-
-    class KVTrans {
-    private:
-        const uint64_t rep_;
-
-    public:
-        explicit KVTrans(uint64_t rep) : rep_(rep) {}
-
-    public:
-        bool operator==(const Slice & k) const {
-            return memcmp(&rep_, k.data(), sizeof(uint32_t)) == 0;
-        }
+#include "sig_tree_test_fixture.h"
 
-        Slice Key() const {
-            return {reinterpret_cast<const char *>(&rep_), sizeof(uint32_t)};
-        }
+namespace sgt::sig_tree_test {
+    // 非默认页大小: 2KB 的页使树更深、分裂更频繁, 16KB 的页使 Pyramid 超过 3 层
+    template<size_t PAGE_SIZE>
+    void RunWithPageSize(std::default_random_engine * engine) {
+        typedef SignatureTreeTpl<KVTrans, uint16_t, uint64_t, NodePolicy<PAGE_SIZE>> Tree;
+        static_assert(Tree::kPageSize == PAGE_SIZE);
+        static_assert(PAGE_SIZE != 16384 || Tree::kNodeRank > 512);
 
-        bool Get(const Slice & k, std::string * v) const {
-            if (*this == k) {
-                if (v != nullptr) {
-                    v->assign(reinterpret_cast<const char *>(&rep_) + sizeof(uint32_t),
-                              reinterpret_cast<const char *>(&rep_) + sizeof(uint64_t));
-                }
-                return true;
+        struct cmp {
+            bool operator()(uint32_t a, uint32_t b) const {
+                return memcmp(&a, &b, sizeof(uint32_t)) < 0;
             }
-            return false;
-        }
-    };
-
-    class Helper : public SignatureTreeTpl<KVTrans>::Helper {
-    public:
-        ~Helper() override = default;
-
-    public:
-        uint64_t Add(const Slice & k, const Slice & v) override {
-            assert(k.size() == sizeof(uint32_t) && v.size() == sizeof(uint32_t));
-            uint32_t ki;
-            uint32_t vi;
-            memcpy(&ki, k.data(), sizeof(ki));
-            memcpy(&vi, v.data(), sizeof(vi));
-            assert(ki % 2 == 1);
-            return (static_cast<uint64_t>(vi) << 32) | ki;
-        }
-
-        void Del(KVTrans & trans) override {}
-
-        uint64_t Pack(size_t offset) const override {
-            assert(offset % 2 == 0);
-            return offset;
-        }
-
-        size_t Unpack(const uint64_t & rep) const override {
-            return rep;
-        }
-
-        bool IsPacked(const uint64_t & rep) const override {
-            return rep % 2 == 0;
-        }
+        };
+        std::set<uint32_t, cmp> set;
 
-        KVTrans Trans(const uint64_t & rep) const override {
-            return KVTrans(rep);
+        Helper helper;
+        AllocatorImpl allocator(PAGE_SIZE);
+        Tree tree(&helper, &allocator);
+        std::uniform_int_distribution<uint32_t> dist(0, UINT32_MAX >> 1);
+        for (size_t i = 0; i < 20000; ++i) {
+            uint32_t v = (dist(*engine) << 16) | (dist(*engine) % 8);
+            v += (v % 2 == 0);
+            Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+            if (i % 3 == 2 && !set.empty()) { // 删除一个已有的 Key
+                auto it = set.lower_bound(v);
+                v = it != set.cend() ? *it : *set.cbegin();
+                set.erase(v);
+                bool deleted = tree.Del(s);
+                assert(deleted);
+                static_cast<void>(deleted);
+            } else {
+                set.emplace(v);
+                tree.Add(s, s);
+            }
+            assert(tree.Size() == set.size());
         }
-    };
 
-    class AllocatorImpl : public Allocator {
-    public:
-        std::unordered_set<uintptr_t> records_;
+        auto check = [&]() {
+            auto it = set.cbegin();
+            tree.template Visit<Tree::kForward>("", [&it](const uint64_t & rep) {
+                uint32_t v = *it++;
+                return v == (rep >> 32);
+            });
+            assert(it == set.cend());
+            std::string out;
+            for (uint32_t v:set) {
+                Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+                bool found = tree.Get(s, &out);
+                assert(found && s == out);
+                static_cast<void>(found);
+            }
+        };
+        check();
+        tree.Compact();
+        check();
 
-    public:
-        ~AllocatorImpl() override {
-            for (uintptr_t record:records_) {
-                free(reinterpret_cast<void *>(record));
+        // 页大小记录在文件中, 以其他页大小打开时拒绝
+        char path[] = "/tmp/sig_tree_test_XXXXXX";
+        close(mkstemp(path));
+        {
+            MmapAllocatorTpl<NodePolicy<PAGE_SIZE>> mmap_allocator(path);
+            Tree persisted(&helper, &mmap_allocator);
+            for (uint32_t v:set) {
+                Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+                persisted.Add(s, s);
             }
+            assert(persisted.Size() == set.size());
         }
-
-    public:
-        void * Base() override {
-            return nullptr;
+        bool rejected = false;
+        try {
+            MmapAllocator mmap_allocator(path);
+        } catch (const std::runtime_error &) {
+            rejected = true;
         }
+        assert(rejected);
+        static_cast<void>(rejected);
+        unlink(path);
 
-        size_t AllocatePage() override {
-            auto page = reinterpret_cast<uintptr_t>(malloc(kPageSize));
-            records_.emplace(page);
-            return page;
-        }
+        // 根为 8 个 Key 加一个几乎满的子 Node, 删除一个 Key 后子 Node 并入根
+        // 根原先只有 8 个 diff, pyramid 未建, 合并后须从头重建
+        {
+            std::vector<uint32_t> vs;
+            for (uint32_t i = 0; i < 8; ++i) {
+                vs.emplace_back(2 * i + 1);
+            }
+            for (uint32_t i = 0; i < Tree::kNodeRepRank - 7; ++i) {
+                vs.emplace_back(0xFF | (i << 8));
+            }
+            std::sort(vs.begin(), vs.end(), cmp());
 
-        void FreePage(size_t offset) override {
-            auto it = records_.find(offset);
-            free(reinterpret_cast<void *>(*it));
-            records_.erase(it);
+            Tree merged(&helper, &allocator);
+            auto it = vs.cbegin();
+            uint32_t k;
+            merged.BulkLoad([&](Slice * s, uint64_t * rep) {
+                if (it == vs.cend()) {
+                    return false;
+                }
+                k = *it++;
+                *s = {reinterpret_cast<char *>(&k), sizeof(k)};
+                *rep = (static_cast<uint64_t>(k) << 32) | k;
+                return true;
+            });
+            uint32_t last = vs.back();
+            vs.pop_back();
+            bool deleted = merged.Del(Slice(reinterpret_cast<char *>(&last), sizeof(last)));
+            assert(deleted);
+            static_cast<void>(deleted);
+            for (uint32_t v:vs) {
+                bool found = merged.Get(Slice(reinterpret_cast<char *>(&v), sizeof(v)), nullptr);
+                assert(found);
+                static_cast<void>(found);
+            }
         }
-
-        void Grow() override {}
-    };
+    }
 
     void Run() {
         constexpr unsigned int kTestTimes = 10000;
@@ -183,6 +208,214 @@ namespace sgt::sig_tree_test {
                 assert(it == set.begin());
             }
         }
+        {
+            // 正反两个扫描交错推进
+            SignatureTreeTpl<KVTrans>::Iterator forward(&tree);
+            SignatureTreeTpl<KVTrans>::Iterator backward(&tree);
+            forward.SeekToFirst();
+            backward.SeekToLast();
+            auto it = set.cbegin();
+            auto rit = set.crbegin();
+            for (; it != set.cend(); ++it, ++rit) {
+                assert(forward.Valid() && backward.Valid());
+                assert(*it == (forward.Rep() >> 32) && *rit == (backward.Rep() >> 32));
+                forward.Next();
+                backward.Prev();
+            }
+            assert(!forward.Valid() && !backward.Valid());
+
+            for (size_t i = 0; i < 1000; ++i) {
+                uint32_t val = dist(engine);
+                Slice s(reinterpret_cast<char *>(&val), sizeof(val));
+                auto lower = set.lower_bound(val);
+                forward.Seek(s);
+                assert(lower == set.cend() ? !forward.Valid() : *lower == (forward.Rep() >> 32));
+                static_cast<void>(lower);
+
+                auto upper = set.upper_bound(val);
+                backward.SeekForPrev(s);
+                assert(upper == set.cbegin() ? !backward.Valid() : *--upper == (backward.Rep() >> 32));
+                if (backward.Valid()) {
+                    backward.Next();
+                    upper = set.upper_bound(val);
+                    assert(upper == set.cend() ? !backward.Valid() : *upper == (backward.Rep() >> 32));
+                }
+                static_cast<void>(upper);
+            }
+        }
+        {
+            // 逐点查询, 半数取自已有 Key
+            auto expect = [&set](auto it, const uint64_t * rep) {
+                return it == set.cend() ? rep == nullptr : rep != nullptr && *it == (*rep >> 32);
+            };
+            auto pick = std::next(set.cbegin(), set.size() / 2);
+            for (size_t i = 0; i < 2000; ++i) {
+                uint32_t val = i % 2 == 0 ? dist(engine) : *pick++;
+                Slice s(reinterpret_cast<char *>(&val), sizeof(val));
+                assert(expect(set.lower_bound(val), tree.LowerBound(s)));
+                assert(expect(set.lower_bound(val), tree.Ceil(s)));
+                assert(expect(set.upper_bound(val), tree.UpperBound(s)));
+                auto upper = set.upper_bound(val);
+                assert(upper == set.cbegin() ? tree.Floor(s) == nullptr : expect(--upper, tree.Floor(s)));
+                static_cast<void>(upper);
+            }
+            static_cast<void>(expect);
+            uint32_t first = *set.cbegin();
+            uint32_t last = *set.crbegin();
+            assert(tree.Floor(Slice(reinterpret_cast<char *>(&first), sizeof(first)))
+                   == tree.LowerBound(Slice(reinterpret_cast<char *>(&first), sizeof(first))));
+            assert(tree.UpperBound(Slice(reinterpret_cast<char *>(&last), sizeof(last))) == nullptr);
+            static_cast<void>(first);
+            static_cast<void>(last);
+        }
+        {
+            // 批量定位, 每个 target 之后再读 4 个
+            std::vector<uint32_t> vals(1000);
+            std::vector<Slice> targets;
+            for (size_t i = 0; i < vals.size(); ++i) {
+                vals[i] = i % 4 == 0 ? *std::next(set.cbegin(), dist(engine) % set.size()) : dist(engine);
+            }
+            for (auto & val:vals) {
+                targets.emplace_back(reinterpret_cast<char *>(&val), sizeof(val));
+            }
+            std::vector<bool> seen(vals.size());
+            tree.MultiSeek(targets.data(), targets.size(), [&](size_t i, SignatureTreeTpl<KVTrans>::Iterator & iter) {
+                assert(!seen[i]);
+                seen[i] = true;
+                auto it = set.lower_bound(vals[i]);
+                for (size_t step = 0; step < 5 && it != set.cend(); ++step, ++it) {
+                    assert(iter.Valid() && *it == (iter.Rep() >> 32));
+                    iter.Next();
+                }
+                assert(it != set.cend() || !iter.Valid());
+            }, 8);
+            assert(std::find(seen.cbegin(), seen.cend(), false) == seen.cend());
+        }
+        {
+            // 并行扫描随机区间, 无序结果按 part 拼接后与有序结果一致
+            for (size_t i = 0; i < 16; ++i) {
+                uint32_t lo = dist(engine);
+                uint32_t hi = dist(engine);
+                if (cmp()(hi, lo)) {
+                    std::swap(lo, hi);
+                }
+                Slice lo_s(reinterpret_cast<char *>(&lo), sizeof(lo));
+                Slice hi_s(reinterpret_cast<char *>(&hi), sizeof(hi));
+                if (i == 0) {
+                    lo_s = hi_s = {};
+                }
+                std::vector<uint32_t> expect(i == 0 ? set.cbegin() : set.lower_bound(lo),
+                                             i == 0 ? set.cend() : set.lower_bound(hi));
+
+                std::mutex mutex;
+                std::vector<std::pair<size_t, uint32_t>> got;
+                tree.ParallelVisit(lo_s, hi_s, 4, [&](size_t part, const uint64_t & rep) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    got.emplace_back(part, rep >> 32);
+                    return true;
+                });
+                std::stable_sort(got.begin(), got.end(), [](const auto & a, const auto & b) {
+                    return a.first < b.first;
+                });
+                assert(got.size() == expect.size());
+                for (size_t j = 0; j < got.size(); ++j) {
+                    assert(got[j].second == expect[j]);
+                }
+
+                std::vector<uint32_t> ordered;
+                tree.ParallelVisit<true>(lo_s, hi_s, 3, [&](size_t, const uint64_t & rep) {
+                    ordered.emplace_back(rep >> 32);
+                    return true;
+                });
+                assert(ordered == expect);
+
+                ordered.clear();
+                tree.ParallelVisit<true>(lo_s, hi_s, 2, [&](size_t, const uint64_t & rep) {
+                    ordered.emplace_back(rep >> 32);
+                    return ordered.size() < 100;
+                });
+                expect.resize(std::min(expect.size(), static_cast<size_t>(100)));
+                assert(ordered == expect);
+            }
+        }
+        {
+            // 前缀取自已有或随机的 Key, 长度 0 至 5
+            for (size_t i = 0; i < 200; ++i) {
+                uint32_t val = i % 2 == 0 ? *std::next(set.cbegin(), dist(engine) % set.size()) : dist(engine);
+                char buf[5] = {};
+                memcpy(buf, &val, sizeof(val));
+                Slice prefix(buf, i % 6);
+                std::vector<uint32_t> expect;
+                for (uint32_t v:set) {
+                    if (prefix.size() <= sizeof(v) && memcmp(&v, prefix.data(), prefix.size()) == 0) {
+                        expect.emplace_back(v);
+                    }
+                }
+                std::vector<uint32_t> got;
+                tree.VisitPrefix(prefix, [&got](const uint64_t & rep) {
+                    got.emplace_back(rep >> 32);
+                    return true;
+                });
+                assert(got == expect);
+                assert(tree.CountPrefix(prefix) == expect.size());
+            }
+        }
+        {
+            // 估计值仅在区间为空时为 0
+            for (size_t i = 0; i < 200; ++i) {
+                uint32_t lo = dist(engine);
+                uint32_t hi = i % 2 == 0 ? lo + (dist(engine) % 0x1000) : dist(engine);
+                Slice lo_s(reinterpret_cast<char *>(&lo), sizeof(lo));
+                Slice hi_s(reinterpret_cast<char *>(&hi), sizeof(hi));
+                size_t expect = cmp()(lo, hi) ? std::distance(set.lower_bound(lo), set.lower_bound(hi)) : 0;
+                assert((tree.EstimateRange(lo_s, hi_s) == 0) == (expect == 0));
+                assert(tree.EstimateRange(lo_s, {}) > 0 || set.lower_bound(lo) == set.cend());
+                static_cast<void>(expect);
+            }
+            assert(tree.EstimateRange({}, {}) > 0);
+        }
+        {
+            // 抽样均为已有的 Key; 分位点递增, 各段大小与 n / q 相差在 4 倍以内
+            auto samples = tree.Sample(1000, engine);
+            assert(samples.size() == 1000);
+            for (const auto & rep:samples) {
+                assert(set.count(rep >> 32) == 1);
+                static_cast<void>(rep);
+            }
+            assert(tree.Sample(0, engine).empty());
+
+            constexpr size_t kQ = 8;
+            auto splits = tree.Quantiles(kQ);
+            assert(splits.size() == kQ - 1);
+            auto prev = set.cbegin();
+            for (size_t i = 0; i < kQ; ++i) {
+                auto next = i + 1 < kQ ? set.find(splits[i] >> 32) : set.cend();
+                size_t part = std::distance(prev, next);
+                assert(part * kQ * 4 >= set.size() && part * kQ <= set.size() * 4);
+                static_cast<void>(part);
+                prev = next;
+            }
+            assert(tree.Quantiles(1).empty());
+        }
+
+        {
+            std::vector<std::thread> readers;
+            for (size_t t = 0; t < 4; ++t) {
+                readers.emplace_back([&tree, &set]() {
+                    std::string out;
+                    for (uint32_t v:set) {
+                        Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+                        bool found = tree.Get(s, &out);
+                        assert(found && s == out);
+                        assert(v == (*tree.GetWithCallback(s) >> 32));
+                        static_cast<void>(found);
+                    }
+                });
+            }
+            for (auto & reader:readers) {
+                reader.join();
+            }
+        }
 
         for (auto it = set.cbegin(); it != set.cend();) {
             uint32_t v0 = *it++;
@@ -197,6 +430,113 @@ namespace sgt::sig_tree_test {
                 assert(v1 == (*reps[1] >> 32));
             });
         }
+        {
+            std::vector<uint32_t> vs(set.cbegin(), set.cend());
+            std::shuffle(vs.begin(), vs.end(), engine);
+            std::vector<Slice> ss;
+            for (const uint32_t & v:vs) {
+                ss.emplace_back(reinterpret_cast<const char *>(&v), sizeof(v));
+            }
+            for (size_t width:{1, 3, 16, 1000}) {
+                std::vector<bool> seen(ss.size());
+                tree.MultiGet(ss.data(), ss.size(), [&](size_t i, uint64_t * rep) {
+                    assert(!seen[i] && vs[i] == (*rep >> 32));
+                    seen[i] = true;
+                }, width);
+                assert(std::find(seen.cbegin(), seen.cend(), false) == seen.cend());
+            }
+            tree.MultiGet(ss.data(), 0, [](size_t, uint64_t *) { assert(false); });
+        }
+        {
+            std::vector<uint32_t> vs(set.cbegin(), set.cend());
+            SignatureTreeTpl<KVTrans>::LookupScheduler scheduler(&tree, 8);
+            size_t found = 0;
+            for (const uint32_t & v:vs) {
+                scheduler.Submit({reinterpret_cast<const char *>(&v), sizeof(v)}, [&found, v](uint64_t * rep) {
+                    assert(v == (*rep >> 32));
+                    ++found;
+                });
+            }
+            assert(scheduler.Inflight() == vs.size());
+            scheduler.Run();
+            assert(found == vs.size() && scheduler.Inflight() == 0);
+
+            uint32_t v = vs.front();
+            SignatureTreeTpl<KVTrans>::Lookup lookup(&tree, {reinterpret_cast<const char *>(&v), sizeof(v)});
+            while (!lookup.Resume()) {}
+            assert(lookup.Result() == tree.GetWithCallback({reinterpret_cast<const char *>(&v), sizeof(v)}));
+        }
+
+        {
+            std::array<AllocatorImpl, 3> shard_allocators;
+            auto mid = std::next(set.cbegin(), set.size() / 3);
+            auto last = std::next(mid, set.size() / 3);
+            uint32_t a = *mid;
+            uint32_t b = *last;
+            ShardedSignatureTreeTpl<KVTrans> sharded(&helper, {&shard_allocators[0],
+                                                                &shard_allocators[1],
+                                                                &shard_allocators[2]},
+                                                     {{reinterpret_cast<char *>(&a), sizeof(a)},
+                                                      {reinterpret_cast<char *>(&b), sizeof(b)}});
+            for (uint32_t v:set) {
+                Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+                sharded.Add(s, s);
+            }
+            assert(sharded.Size() == set.size());
+            assert(!shard_allocators[1].records_.empty() && !shard_allocators[2].records_.empty());
+
+            auto it = set.cbegin();
+            sharded.Visit<tree.kForward>("", [&it](const uint64_t & rep) {
+                uint32_t v = *it++;
+                return v == (rep >> 32);
+            });
+            assert(it == set.cend());
+
+            auto rit = std::make_reverse_iterator(std::next(last));
+            Slice s(reinterpret_cast<char *>(&b), sizeof(b));
+            sharded.Visit<tree.kBackward>(s, [&rit](const uint64_t & rep) {
+                uint32_t v = *rit++;
+                return v == (rep >> 32);
+            });
+            assert(rit == set.crend());
+
+            // 与单棵树相同, 反向访问始于首个不小于 target 的 Key, 它可能在下一片
+            // target 取随机值, 以及恰好位于第 1 片最后一个 Key 与 b 之间的值
+            std::vector<uint32_t> targets;
+            for (size_t i = 0; i < 100; ++i) {
+                targets.emplace_back(dist(engine));
+            }
+            uint32_t before_b = __builtin_bswap32(__builtin_bswap32(b) - 1);
+            if (cmp()(*std::prev(last), before_b)) {
+                targets.emplace_back(before_b);
+            }
+            for (uint32_t target:targets) {
+                Slice t(reinterpret_cast<char *>(&target), sizeof(target));
+                std::vector<uint32_t> visited;
+                sharded.Visit<tree.kBackward>(t, [&visited](const uint64_t & rep) {
+                    visited.emplace_back(rep >> 32);
+                    return true;
+                });
+                std::vector<uint32_t> expect;
+                auto start = set.lower_bound(target);
+                if (start != set.cend()) {
+                    expect.assign(std::make_reverse_iterator(std::next(start)), set.crend());
+                }
+                assert(visited == expect);
+            }
+
+            std::string out;
+            for (uint32_t v:set) {
+                Slice k(reinterpret_cast<char *>(&v), sizeof(v));
+                bool found = sharded.Get(k, &out);
+                assert(found && k == out);
+                bool deleted = sharded.Del(k);
+                assert(deleted);
+                static_cast<void>(found);
+                static_cast<void>(deleted);
+            }
+            assert(sharded.Size() == 0);
+        }
 
         std::string out;
         for (uint32_t v:set) {
@@ -241,6 +581,285 @@ namespace sgt::sig_tree_test {
             }, 0u);
             assert(it == expect.cend());
         }
+        for (double fill_factor:{1.0, 0.5}) {
+            AllocatorImpl bulk_allocator;
+            SignatureTreeTpl<KVTrans> bulk(&helper, &bulk_allocator);
+            auto it = set.cbegin();
+            uint32_t k;
+            bulk.BulkLoad([&](Slice * s, uint64_t * rep) {
+                if (it == set.cend()) {
+                    return false;
+                }
+                k = *it++;
+                *s = {reinterpret_cast<char *>(&k), sizeof(k)};
+                *rep = (static_cast<uint64_t>(k) << 32) | k;
+                return true;
+            }, fill_factor);
+            assert(bulk.Size() == set.size());
+
+            it = set.cbegin();
+            bulk.Visit<tree.kForward>("", [&it](const uint64_t & rep) {
+                uint32_t v = *it++;
+                return v == (rep >> 32);
+            });
+            assert(it == set.cend());
+
+            std::string out;
+            for (uint32_t v:set) {
+                Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+                bulk.Get(s, &out);
+                assert(s == out);
+                if (v % 4 == 1) {
+                    bulk.Del(s);
+                    bulk.Add(s, s);
+                }
+            }
+            assert(bulk.Size() == set.size());
+        }
+        {
+            // 仅差末尾 '\0' 的 Key 无法区分, BulkLoad 跳过后者而不是死循环
+            AllocatorImpl bulk_allocator;
+            SignatureTreeTpl<KVTrans> bulk(&helper, &bulk_allocator);
+            const uint32_t vs[] = {0x00030201, 0x00030201, 0x00030205};
+            const size_t sizes[] = {3, 4, 4};
+            size_t i = 0;
+            bulk.BulkLoad([&](Slice * s, uint64_t * rep) {
+                if (i == 3) {
+                    return false;
+                }
+                *s = {reinterpret_cast<const char *>(&vs[i]), sizes[i]};
+                *rep = (static_cast<uint64_t>(vs[i]) << 32) | vs[i];
+                ++i;
+                return true;
+            });
+            assert(bulk.Size() == 2);
+            for (uint32_t v:vs) {
+                Slice s(reinterpret_cast<const char *>(&v), sizeof(v));
+                bool found = bulk.Get(s, nullptr);
+                assert(found);
+                static_cast<void>(found);
+            }
+        }
+        {
+            AllocatorImpl batch_allocator;
+            SignatureTreeTpl<KVTrans> batched(&helper, &batch_allocator);
+            std::vector<uint32_t> vs(set.cbegin(), set.cend());
+            std::shuffle(vs.begin(), vs.end(), engine);
+
+            // 每批混入批内与批间的重复 Key
+            size_t added = 0;
+            for (size_t i = 0; i < vs.size(); i += 1000) {
+                std::vector<Slice> ss;
+                for (size_t j = i; j < std::min(i + 1000, vs.size()); ++j) {
+                    ss.emplace_back(reinterpret_cast<const char *>(&vs[j]), sizeof(vs[j]));
+                }
+                ss.emplace_back(ss.front());
+                ss.emplace_back(reinterpret_cast<const char *>(&vs[i / 2]), sizeof(vs[i / 2]));
+                added += batched.MultiAdd(ss.data(), ss.data(), ss.size());
+                assert(batched.Size() == std::min(i + 1000, vs.size()));
+            }
+            assert(added == vs.size());
+
+            auto it = set.cbegin();
+            batched.Visit<tree.kForward>("", [&it](const uint64_t & rep) {
+                uint32_t v = *it++;
+                return v == (rep >> 32);
+            });
+            assert(it == set.cend());
+
+            std::vector<Slice> ss;
+            for (size_t j = 0; j < vs.size(); j += 3) {
+                ss.emplace_back(reinterpret_cast<const char *>(&vs[j]), sizeof(vs[j]));
+            }
+            size_t dup = 0;
+            added = batched.MultiAdd(ss.data(), ss.data(), ss.size(), [&dup](KVTrans &, uint64_t &) {
+                ++dup;
+                return true;
+            });
+            assert(added == ss.size() && dup == ss.size());
+            assert(batched.Size() == set.size());
+
+            // 每批混入批内重复与已删除的 Key
+            auto rest = set;
+            std::shuffle(vs.begin(), vs.end(), engine);
+            size_t deleted = 0;
+            for (size_t i = 0; i < vs.size(); i += 997) {
+                ss.clear();
+                for (size_t j = i; j < std::min(i + 997, vs.size()); ++j) {
+                    ss.emplace_back(reinterpret_cast<const char *>(&vs[j]), sizeof(vs[j]));
+                    rest.erase(vs[j]);
+                }
+                ss.emplace_back(ss.back());
+                ss.emplace_back(reinterpret_cast<const char *>(&vs[i / 2]), sizeof(vs[i / 2]));
+                deleted += batched.MultiDel(ss.data(), ss.size());
+                assert(batched.Size() == rest.size());
+
+                if (i % (997 * 16) == 0) {
+                    auto it = rest.cbegin();
+                    batched.Visit<tree.kForward>("", [&it](const uint64_t & rep) {
+                        uint32_t v = *it++;
+                        return v == (rep >> 32);
+                    });
+                    assert(it == rest.cend());
+                }
+            }
+            assert(deleted == vs.size() && batched.Size() == 0);
+        }
+        {
+            AllocatorImpl range_allocator;
+            SignatureTreeTpl<KVTrans> ranged(&helper, &range_allocator);
+            std::vector<Slice> ss;
+            for (const uint32_t & v:set) {
+                ss.emplace_back(reinterpret_cast<const char *>(&v), sizeof(v));
+            }
+            ranged.MultiAdd(ss.data(), ss.data(), ss.size());
+
+            auto rest = set;
+            for (size_t i = 0; i < 64 && !rest.empty(); ++i) {
+                uint32_t lo = dist(engine);
+                uint32_t hi = i % 2 == 0 ? lo + (dist(engine) % 0x10000) : dist(engine);
+                if (cmp()(hi, lo)) {
+                    std::swap(lo, hi);
+                }
+                auto first = rest.lower_bound(lo);
+                auto last = rest.lower_bound(hi);
+                size_t expect = std::distance(first, last);
+                rest.erase(first, last);
+
+                size_t deleted = ranged.DeleteRange(Slice(reinterpret_cast<char *>(&lo), sizeof(lo)),
+                                                    Slice(reinterpret_cast<char *>(&hi), sizeof(hi)));
+                assert(deleted == expect);
+                assert(ranged.Size() == rest.size());
+                static_cast<void>(expect);
+                static_cast<void>(deleted);
+
+                auto it = rest.cbegin();
+                ranged.Visit<tree.kForward>("", [&it](const uint64_t & rep) {
+                    uint32_t v = *it++;
+                    return v == (rep >> 32);
+                });
+                assert(it == rest.cend());
+            }
+
+            size_t deleted = ranged.DeleteRange("", "");
+            assert(deleted == rest.size() && ranged.Size() == 0);
+            assert(range_allocator.records_.size() == 1);
+            static_cast<void>(deleted);
+
+            // 空树的 Rebuild 得到空树, 之后仍可写入
+            for (size_t num_threads:{1, 4}) {
+                Helper dst_helper;
+                AllocatorImpl dst_allocator;
+                SignatureTreeTpl<KVTrans> dst(&dst_helper, &dst_allocator);
+                ranged.Rebuild(&dst, num_threads);
+                assert(dst.Size() == 0);
+                uint32_t v = 1;
+                Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+                dst.Add(s, s);
+                bool found = dst.Get(s, nullptr);
+                assert(found && dst.Size() == 1);
+                static_cast<void>(found);
+            }
+        }
+        {
+            // 全宽随机 Key 与随机 [lo, hi): 两条路径在同一 rep 处仅一条继续向下的情形
+            std::uniform_int_distribution<uint32_t> full;
+            for (size_t round = 0; round < 200; ++round) {
+                AllocatorImpl range_allocator;
+                SignatureTreeTpl<KVTrans> ranged(&helper, &range_allocator);
+                decltype(set) rest;
+                size_t n = std::uniform_int_distribution<size_t>(1, 3000)(engine);
+                for (size_t i = 0; i < n; ++i) {
+                    uint32_t v = full(engine) | 1;
+                    Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+                    ranged.Add(s, s);
+                    rest.emplace(v);
+                }
+
+                uint32_t lo = full(engine);
+                uint32_t hi = full(engine);
+                if (cmp()(hi, lo)) {
+                    std::swap(lo, hi);
+                }
+                size_t expect = std::distance(rest.lower_bound(lo), rest.lower_bound(hi));
+                rest.erase(rest.lower_bound(lo), rest.lower_bound(hi));
+                size_t deleted = ranged.DeleteRange(Slice(reinterpret_cast<char *>(&lo), sizeof(lo)),
+                                                    Slice(reinterpret_cast<char *>(&hi), sizeof(hi)));
+                assert(deleted == expect);
+                assert(ranged.Size() == rest.size());
+                static_cast<void>(expect);
+                static_cast<void>(deleted);
+
+                auto it = rest.cbegin();
+                ranged.Visit<tree.kForward>("", [&it](const uint64_t & rep) {
+                    uint32_t v = *it++;
+                    return v == (rep >> 32);
+                });
+                assert(it == rest.cend());
+            }
+        }
+        {
+            // 每步之间增删 Key, Iterator 从原位置继续
+            AllocatorImpl iter_allocator;
+            SignatureTreeTpl<KVTrans> modified(&helper, &iter_allocator);
+            std::vector<Slice> ss;
+            for (const uint32_t & v:set) {
+                ss.emplace_back(reinterpret_cast<const char *>(&v), sizeof(v));
+            }
+            modified.MultiAdd(ss.data(), ss.data(), ss.size());
+
+            auto rest = set;
+            auto modify = [&](uint32_t cur) {
+                switch (engine() % 4) {
+                    case 0: {
+                        Slice s(reinterpret_cast<char *>(&cur), sizeof(cur));
+                        modified.Del(s);
+                        rest.erase(cur);
+                        break;
+                    }
+                    case 1: {
+                        uint32_t v = (dist(engine) << 16) | (dist(engine) % 8) | 1;
+                        Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+                        modified.Add(s, s);
+                        rest.emplace(v);
+                        break;
+                    }
+                    case 2: {
+                        auto it = rest.lower_bound(dist(engine));
+                        if (it != rest.cend()) {
+                            uint32_t v = *it;
+                            Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+                            modified.Del(s);
+                            rest.erase(it);
+                        }
+                        break;
+                    }
+                    default:
+                        break;
+                }
+            };
+
+            SignatureTreeTpl<KVTrans>::Iterator iter(&modified);
+            iter.SeekToFirst();
+            while (iter.Valid()) {
+                uint32_t cur = iter.Rep() >> 32;
+                modify(cur);
+                iter.Next();
+                auto it = rest.upper_bound(cur);
+                assert(it == rest.cend() ? !iter.Valid() : *it == (iter.Rep() >> 32));
+                static_cast<void>(it);
+            }
+            iter.SeekToLast();
+            while (iter.Valid()) {
+                uint32_t cur = iter.Rep() >> 32;
+                modify(cur);
+                iter.Prev();
+                auto it = rest.lower_bound(cur);
+                assert(it == rest.cbegin() ? !iter.Valid() : *--it == (iter.Rep() >> 32));
+                static_cast<void>(it);
+            }
+            assert(modified.Size() == rest.size());
+        }
         {
             Helper dst_helper;
             AllocatorImpl dst_allocator;
@@ -254,5 +873,214 @@ namespace sgt::sig_tree_test {
             });
             assert(it == expect.cend());
         }
+        {
+            // 重复 Rebuild 复用调用方持有的同一 Page arena, 首次之后不再增长
+            SignatureTreeTpl<KVTrans>::RebuildContext ctx;
+            size_t arena_pages = 0;
+            for (size_t num_threads:{1, 4, 1, 4}) {
+                Helper dst_helper;
+                AllocatorImpl dst_allocator;
+                SignatureTreeTpl<KVTrans> dst(&dst_helper, &dst_allocator);
+                tree.Rebuild(&dst, num_threads, &ctx);
+                assert(dst.Size() == expect.size());
+                if (arena_pages == 0) {
+                    arena_pages = ctx.ArenaPages();
+                    assert(arena_pages > 0);
+                }
+                assert(ctx.ArenaPages() == arena_pages);
+            }
+            static_cast<void>(arena_pages);
+        }
+        {
+            Helper dst_helper;
+            AllocatorImpl dst_allocator;
+            SignatureTreeTpl<KVTrans> dst(&dst_helper, &dst_allocator);
+            tree.Rebuild(&dst, 4);
+
+            auto it = expect.cbegin();
+            dst.Visit<tree.kForward>("", [&it](const uint64_t & rep) {
+                uint32_t v = *it++;
+                return v == (rep >> 32);
+            });
+            assert(it == expect.cend());
+            assert(dst.Size() == expect.size());
+        }
+        {
+            // 预留空间很小, 迫使 Grow 重新映射
+            char path[] = "/tmp/sig_tree_test_XXXXXX";
+            close(mkstemp(path));
+            constexpr size_t kReserveSize = MmapAllocator::kInitSize * 2;
+            {
+                MmapAllocator mmap_allocator(path, kReserveSize);
+                SignatureTreeTpl<KVTrans> persisted(&helper, &mmap_allocator);
+                mmap_allocator.SetRootOffset(persisted.RootOffset());
+                for (uint32_t v:set) {
+                    Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+                    persisted.Add(s, s);
+                }
+                assert(mmap_allocator.FileSize() > kReserveSize);
+            }
+            {
+                MmapAllocator mmap_allocator(path, kReserveSize);
+                SignatureTreeTpl<KVTrans> persisted(&helper, &mmap_allocator, mmap_allocator.RootOffset());
+                auto it = set.cbegin();
+                persisted.Visit<tree.kForward>("", [&it](const uint64_t & rep) {
+                    uint32_t v = *it++;
+                    return v == (rep >> 32);
+                });
+                assert(it == set.cend());
+
+                // 释放的页进入文件内的空闲链表, 再插入时复用而不扩展文件
+                size_t file_size = mmap_allocator.FileSize();
+                for (uint32_t v:set) {
+                    Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+                    persisted.Del(s);
+                }
+                for (uint32_t v:set) {
+                    Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+                    persisted.Add(s, s);
+                }
+                assert(mmap_allocator.FileSize() == file_size);
+                static_cast<void>(file_size);
+                assert(persisted.Size() == set.size());
+            }
+            unlink(path);
+        }
+        {
+            char path[] = "/tmp/sig_tree_test_XXXXXX";
+            close(mkstemp(path));
+            std::string log_path = std::string(path) + ".wal";
+
+            auto half = std::next(set.cbegin(), set.size() / 2);
+            decltype(set) durable_expect;
+            {
+                MmapAllocator mmap_allocator(path, MmapAllocator::kDefaultReserveSize, true);
+                DurableSignatureTreeTpl<KVTrans> durable(&helper, &mmap_allocator, log_path.c_str(), 64);
+                for (auto it = set.cbegin(); it != half; ++it) {
+                    uint32_t v = *it;
+                    Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+                    durable.Add(s, s);
+                }
+                durable.Checkpoint();
+
+                bool del = false;
+                for (auto it = set.cbegin(); it != set.cend(); ++it) {
+                    uint32_t v = *it;
+                    Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+                    if (it != half && (del = !del)) {
+                        durable.Del(s);
+                    } else {
+                        durable.Add(s, s);
+                        durable_expect.emplace(v);
+                    }
+                }
+                durable.Commit();
+            } // 模拟崩溃: 最后一个检查点之后的修改只存在于日志中
+
+            {
+                // 崩溃时写了一半的记录
+                std::ofstream torn(log_path, std::ios::app | std::ios::binary);
+                torn << "torn";
+            }
+
+            for (size_t i = 0; i < 2; ++i) {
+                MmapAllocator mmap_allocator(path, MmapAllocator::kDefaultReserveSize, true);
+                DurableSignatureTreeTpl<KVTrans> durable(&helper, &mmap_allocator, log_path.c_str());
+                auto it = durable_expect.cbegin();
+                durable.Visit<tree.kForward>("", [&it](const uint64_t & rep) {
+                    uint32_t v = *it++;
+                    return v == (rep >> 32);
+                });
+                assert(it == durable_expect.cend());
+                durable.Checkpoint();
+            }
+            unlink(path);
+            unlink(log_path.c_str());
+        }
+
+        if (access("/dev/full", W_OK) == 0) {
+            // 写入 /dev/full 总是 ENOSPC: 失败的一批不得计为持久, 之后的 Append/Sync 持续报错
+            WriteAheadLog log("/dev/full");
+            uint32_t v = 1;
+            Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+            uint64_t lsn = log.Append(WriteAheadLog::kAdd, s, s);
+            size_t failures = 0;
+            for (size_t i = 0; i < 2; ++i) {
+                try {
+                    log.Sync(lsn);
+                } catch (const std::system_error & e) {
+                    failures += (e.code().value() == ENOSPC);
+                }
+            }
+            try {
+                log.Append(WriteAheadLog::kAdd, s, s);
+            } catch (const std::system_error &) {
+                ++failures;
+            }
+            assert(failures == 3);
+            static_cast<void>(failures);
+        }
+        {
+            // region 很小, 迫使多次 Grow, Base() 与已有 offset 保持不变
+            // 节点 0 总是存在, 交错到 {0} 即可覆盖 mbind
+            for (auto numa:{NumaPolicy::kNumaDefault, NumaPolicy::kNumaInterleave}) {
+                HugePageMode mode = numa == NumaPolicy::kNumaDefault ? HugePageMode::kNone : HugePageMode::kTransparent;
+                HugePageAllocator hp_allocator(mode, kPageSize * 4, numa, 1);
+                void * base = hp_allocator.Base();
+                SignatureTreeTpl<KVTrans> hp(&helper, &hp_allocator);
+                for (uint32_t v:set) {
+                    Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+                    hp.Add(s, s);
+                }
+                assert(hp_allocator.CommittedSize() > kPageSize * 4);
+                assert(hp_allocator.Base() == base);
+                static_cast<void>(base);
+
+                auto it = set.cbegin();
+                hp.Visit<tree.kForward>("", [&it](const uint64_t & rep) {
+                    uint32_t v = *it++;
+                    return v == (rep >> 32);
+                });
+                assert(it == set.cend());
+
+                // 释放的页复用, 不再提交新的 region
+                size_t committed_size = hp_allocator.CommittedSize();
+                for (uint32_t v:set) {
+                    Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+                    hp.Del(s);
+                }
+                for (uint32_t v:set) {
+                    Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+                    hp.Add(s, s);
+                }
+                assert(hp_allocator.CommittedSize() == committed_size);
+                static_cast<void>(committed_size);
+                assert(hp.Size() == set.size());
+            }
+
+            bool rejected = false;
+            try {
+                HugePageAllocator hp_allocator(HugePageMode::kNone, kPageSize * 3);
+            } catch (const std::invalid_argument &) {
+                rejected = true;
+            }
+            assert(rejected);
+            static_cast<void>(rejected);
+
+            // 系统可能未预留大页: 要么正常工作, 要么构造时抛出 system_error
+            try {
+                HugePageAllocator hp_allocator(HugePageMode::kHugeTlb);
+                SignatureTreeTpl<KVTrans> hp(&helper, &hp_allocator);
+                for (uint32_t v:set) {
+                    Slice s(reinterpret_cast<char *>(&v), sizeof(v));
+                    hp.Add(s, s);
+                }
+                assert(hp.Size() == set.size());
+            } catch (const std::system_error &) {
+            }
+        }
+
+        RunWithPageSize<2048>(&engine);
+        RunWithPageSize<16384>(&engine);
     }
 }
\ No newline at end of file
@@ -0,0 +1,130 @@
+#pragma once
+#ifndef SIG_TREE_SIG_TREE_TEST_FIXTURE_H
+#define SIG_TREE_SIG_TREE_TEST_FIXTURE_H
+
+/*
+ * 各测试共用的 KVTrans/Helper/AllocatorImpl
+ * 须在测试文件的模式宏 (SGT_OPTIMISTIC_LOCK 等) 之后包含
+ * 树的布局随模式而变, 故置于匿名 namespace, 各翻译单元各有一份
+ */
+
+#include <cstring>
+#include <mutex>
+#include <unordered_set>
+
+#include "../src/sig_tree.h"
+
+namespace sgt {
+    namespace {
+        /*
+         * K = uint32_t
+         * V = uint32_t
+         * little-endian REP : uint64_t = (V << 32) | K
+         *
+         * if REP % 2 = 0, then REP is packed
+         */
+
+        class KVTrans {
+        private:
+            const uint64_t rep_;
+
+        public:
+            explicit KVTrans(uint64_t rep) : rep_(rep) {}
+
+        public:
+            bool operator==(const Slice & k) const {
+                return memcmp(&rep_, k.data(), sizeof(uint32_t)) == 0;
+            }
+
+            Slice Key() const {
+                return {reinterpret_cast<const char *>(&rep_), sizeof(uint32_t)};
+            }
+
+            bool Get(const Slice & k, std::string * v) const {
+                if (*this == k) {
+                    if (v != nullptr) {
+                        v->assign(reinterpret_cast<const char *>(&rep_) + sizeof(uint32_t),
+                                  reinterpret_cast<const char *>(&rep_) + sizeof(uint64_t));
+                    }
+                    return true;
+                }
+                return false;
+            }
+        };
+
+        class Helper : public SignatureTreeTpl<KVTrans>::Helper {
+        public:
+            ~Helper() override = default;
+
+        public:
+            uint64_t Add(const Slice & k, const Slice & v) override {
+                assert(k.size() == sizeof(uint32_t) && v.size() == sizeof(uint32_t));
+                uint32_t ki;
+                uint32_t vi;
+                memcpy(&ki, k.data(), sizeof(ki));
+                memcpy(&vi, v.data(), sizeof(vi));
+                assert(ki % 2 == 1);
+                return (static_cast<uint64_t>(vi) << 32) | ki;
+            }
+
+            void Del(KVTrans & trans) override {}
+
+            uint64_t Pack(size_t offset) const override {
+                assert(offset % 2 == 0);
+                return offset;
+            }
+
+            size_t Unpack(const uint64_t & rep) const override {
+                return rep;
+            }
+
+            bool IsPacked(const uint64_t & rep) const override {
+                return rep % 2 == 0;
+            }
+
+            KVTrans Trans(const uint64_t & rep) const override {
+                return KVTrans(rep);
+            }
+        };
+
+        // 页直接取自 malloc, offset 即地址; OLC 下并发写者同时分配页, 故加锁
+        class AllocatorImpl : public Allocator {
+        public:
+            std::mutex mutex_;
+            std::unordered_set<uintptr_t> records_;
+            const size_t page_size_;
+
+        public:
+            explicit AllocatorImpl(size_t page_size = kPageSize) : page_size_(page_size) {}
+
+            ~AllocatorImpl() override {
+                for (uintptr_t record:records_) {
+                    free(reinterpret_cast<void *>(record));
+                }
+            }
+
+        public:
+            void * Base() override {
+                return nullptr;
+            }
+
+            size_t AllocatePage() override {
+                auto page = reinterpret_cast<uintptr_t>(malloc(page_size_));
+                std::lock_guard<std::mutex> lock(mutex_);
+                records_.emplace(page);
+                return page;
+            }
+
+            void FreePage(size_t offset) override {
+                std::lock_guard<std::mutex> lock(mutex_);
+                auto it = records_.find(offset);
+                free(reinterpret_cast<void *>(*it));
+                records_.erase(it);
+            }
+
+            void Grow() override {}
+        };
+    }
+}
+
+#endif //SIG_TREE_SIG_TREE_TEST_FIXTURE_H